@@ -0,0 +1,143 @@
+#ifndef DIVA_PROTOCOL_H_
+#define DIVA_PROTOCOL_H_
+
+/* Wire formats shared between the firmware and the host tools in tools/ */
+
+#include <stdint.h>
+
+#define JOY_REPORT_SIZE       8 // gamepad input report length
+#define JOY_REPORT_VENDOR_IDX 7 // offset of the VendorSpec byte
+
+/* VendorSpec byte (gamepad mode, REPORT_INPUT_AGE enabled)
+ *
+ *   bit 7..4 : rolling report sequence number (+1 per report handed to the USB stack, accepted reports are never lost on the bus
+ *              so a gap means the host side reader missed reports)
+ *   bit 3..0 : input age code, time from the newest slider frame or button edge to report build
+ *              0 = less than 16us, n = [16 << (n-1), 16 << n) us, 15 = saturated (262ms and more)
+ */
+#define INPUT_AGE_SEQ_MOD   16
+#define INPUT_AGE_CODE_MAX  15
+#define INPUT_AGE_UNIT_US   16u
+
+static inline uint8_t input_age_encode(uint32_t age_us)
+{
+    uint8_t code = 0;
+    age_us /= INPUT_AGE_UNIT_US;
+    while (age_us && code < INPUT_AGE_CODE_MAX)
+    {
+        age_us >>= 1;
+        code++;
+    }
+    return code;
+}
+
+static inline uint8_t input_age_vendor_byte(uint8_t seq, uint32_t age_us)
+{
+    return ((seq % INPUT_AGE_SEQ_MOD) << 4) | input_age_encode(age_us);
+}
+
+static inline uint8_t input_age_seq(uint8_t vendor)
+{
+    return vendor >> 4;
+}
+
+// lower bound (in us) of the age bucket
+static inline uint32_t input_age_min_us(uint8_t vendor)
+{
+    uint8_t code = vendor & 0x0F;
+    return code ? (INPUT_AGE_UNIT_US << (code - 1)) : 0;
+}
+
+// upper bound (in us) of the age bucket, UINT32_MAX when saturated
+static inline uint32_t input_age_max_us(uint8_t vendor)
+{
+    uint8_t code = vendor & 0x0F;
+    return (code < INPUT_AGE_CODE_MAX) ? (INPUT_AGE_UNIT_US << code) : UINT32_MAX;
+}
+
+/* Input event report (INPUT_EVENT_REPORT enabled), sent on a second HID interface.
+ * Carries every input change since the previous report, in order, with its device timestamp.
+ */
+#define INPUT_ID_BUTTON(i)   (i)        // bit i of the button state (TRIANGLE, SQUARE, CROSS, CIRCLE, L1, R1, L2, R2,
+                                        // SHARE, OPTIONS, HOME, R3, L3, UP, RIGHT, DOWN, LEFT)
+#define INPUT_ID_SLIDER(c)   (32 + (c)) // bit c of the 32 cells slider (bit 31 is the leftmost cell)
+#define INPUT_ID_SLIDE(slot)  (64 + (slot)) // slide tracker contact slot, state is a SLIDE_STATE()
+#define INPUT_ID_IS_BUTTON(id) ((id) < 32)
+#define INPUT_ID_IS_SLIDER(id) ((id) >= 32 && (id) < 64)
+#define INPUT_ID_IS_SLIDE(id)  ((id) >= 64 && (id) < 72)
+
+/* Slide events, emitted when a tracked contact moves across cells (see slide_tracker.h)
+ * (cell 0 is the leftmost one, same numbering as slide_contact_report_t)
+ */
+#define SLIDE_STARTED   1 // contact moved to the next zone (two cells)
+#define SLIDE_CONTINUED 2 // each further zone in the same direction (or two zones when reversing)
+#define SLIDE_ENDED     3 // contact released or stopped after sliding
+
+#define SLIDE_STATE(type, cell, left) ((type) | ((cell) << 2) | ((left) ? 0x80 : 0))
+#define SLIDE_STATE_TYPE(state) ((state) & 0x03)
+#define SLIDE_STATE_CELL(state) (((state) >> 2) & 0x1F)
+#define SLIDE_STATE_LEFT(state) ((state) >> 7)
+
+#define EVENT_REPORT_SIZE   64
+#define EVENT_REPORT_EVENTS 14
+
+typedef struct __attribute__((packed)) input_event_s {
+    uint16_t dt_us; // time since base_us
+    uint8_t  id;    // INPUT_ID_*
+    uint8_t  state; // 1 pressed/touched, 0 released
+} input_event_t;
+
+typedef struct __attribute__((packed)) event_report_s {
+    uint8_t  seq;      // +1 per report
+    uint8_t  count;    // valid entries in events
+    uint32_t base_us;  // device time (us, wraps) of the first event
+    input_event_t events[EVENT_REPORT_EVENTS];
+    uint16_t dropped;  // events lost on the device since boot (wraps)
+} event_report_t;
+
+/* Slider filter, read with GET_REPORT (Feature) as part of the diagnostics,
+ * changed with SET_REPORT (Feature, report id 0) carrying a slider_filter_report_t.
+ */
+#define SLIDER_FILTER_PASS       0
+#define SLIDER_FILTER_MAJORITY   1 // n = scans needed, m = window
+#define SLIDER_FILTER_ASYMMETRIC 2 // n = press confirmation scans, m = release confirmation scans
+
+typedef struct __attribute__((packed)) slider_filter_report_s {
+    uint8_t mode;
+    uint8_t n;
+    uint8_t m;
+} slider_filter_report_t;
+
+typedef struct __attribute__((packed)) slide_contact_report_s {
+    uint16_t position; // contact center, 1/256 cell, 0 is the middle of the leftmost cell
+    int16_t  velocity; // cells per second, positive to the right
+} slide_contact_report_t;
+
+#define SLIDE_REPORT_CONTACTS 2
+
+/* Diagnostics, returned on GET_REPORT (Feature, report id 0) in both modes.
+ * Fields are little endian and only ever appended, check size before reading new ones.
+ */
+#define DIAG_REPORT_VERSION 1
+
+typedef struct __attribute__((packed)) diag_report_s {
+    uint8_t  version;
+    uint8_t  size;             // sizeof(diag_report_t) on the device
+    uint32_t latched_presses;  // presses released before a report was sent, only reported thanks to latching
+    uint32_t mount_us;         // reset (or mode change reconnect) to USB configured
+    uint32_t first_report_us;  // reset (or mode change reconnect) to first report handed to the USB stack
+    uint16_t sniffer_restarts; // i2c sniffer restarts after a slider traffic stall (includes Ipega boot)
+    uint8_t  watchdog_reboot;  // last reset was caused by the watchdog
+    slider_filter_report_t filter; // current slider filter
+    uint16_t filter_press_us;   // latency added by the slider filter on press
+    uint16_t filter_release_us; // latency added by the slider filter on release
+    uint16_t scan_period_us;    // time between two scans of a same slider half
+    uint16_t in_latency_min_us; // input change to completion of the IN transfer reporting it
+    uint16_t in_latency_avg_us;
+    uint16_t in_latency_max_us;
+    uint32_t in_latency_samples;
+    uint8_t  slide_contacts;    // contacts currently on the slider
+    slide_contact_report_t slide[SLIDE_REPORT_CONTACTS]; // first tracked contacts
+} diag_report_t;
+
+#endif /* DIVA_PROTOCOL_H_ */
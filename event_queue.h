@@ -0,0 +1,65 @@
+#ifndef EVENT_QUEUE_H_
+#define EVENT_QUEUE_H_
+
+/* Lock-free single producer / single consumer queue of timestamped input events.
+ * The producer only writes head, the consumer only writes tail, so core 0 can
+ * feed core 1 without spinlocks: head is published with a release store and read
+ * with an acquire load, so are the released entries through tail. The consumer can read ahead with
+ * event_queue_peek() and only release entries once they were sent.
+ */
+
+#include "pico/stdlib.h"
+
+#define EVENT_QUEUE_SIZE 64 // power of two
+
+typedef struct timed_event_s {
+    uint32_t us;    // time_us_32() of the event
+    uint8_t  id;    // INPUT_ID_*
+    uint8_t  state;
+} timed_event_t;
+
+typedef struct event_queue_s {
+    uint32_t head;    // next slot to write (producer)
+    uint32_t tail;    // next slot to read (consumer)
+    uint32_t dropped; // events lost because the queue was full (producer)
+    timed_event_t ev[EVENT_QUEUE_SIZE];
+} event_queue_t;
+
+// producer side
+static inline bool event_queue_push(event_queue_t *q, uint32_t us, uint8_t id, uint8_t state)
+{
+    uint32_t head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) >= EVENT_QUEUE_SIZE)
+    {
+        __atomic_store_n(&q->dropped, q->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    timed_event_t *ev = &q->ev[head % EVENT_QUEUE_SIZE];
+    ev->us = us;
+    ev->id = id;
+    ev->state = state;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE); // entry visible before the new head
+    return true;
+}
+
+// consumer side, returns the idx-th pending event (0 = oldest) or NULL
+static inline const timed_event_t *event_queue_peek(event_queue_t *q, uint32_t idx)
+{
+    uint32_t tail = q->tail;
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - tail <= idx)
+        return NULL;
+    return &q->ev[(tail + idx) % EVENT_QUEUE_SIZE];
+}
+
+static inline uint32_t event_queue_dropped(event_queue_t *q)
+{
+    return __atomic_load_n(&q->dropped, __ATOMIC_RELAXED);
+}
+
+static inline void event_queue_pop(event_queue_t *q, uint32_t count)
+{
+    __atomic_store_n(&q->tail, q->tail + count, __ATOMIC_RELEASE); // done reading the entries before handing them back
+}
+
+#endif /* EVENT_QUEUE_H_ */
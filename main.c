@@ -9,14 +9,36 @@
 #include "hardware/pio.h"
 #include "hardware/timer.h"
 #include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "hardware/dma.h"
+#include "hardware/watchdog.h"
 #include "i2c_sniffer.pio.h"
+#include "button_sampler.pio.h"
 #include "pico/multicore.h"
 #include "pico/bootrom.h"
 #include "tusb_config.h"
 
 #include "usb_descriptors.h"
+#include "diva_protocol.h"
+#include "slider_filter.h"
+#include "event_queue.h"
+#include "slide_tracker.h"
 
-#define DEBOUNCE_CYCLES 500 // number of input poll cycles to debounce (0 to disable)
+#define DEBOUNCE_CYCLES 500 // number of input poll cycles to debounce, GPIO polling only (0 to disable)
+#define DEBOUNCE_US      2500 // how long a sampled face button press is held before it can be released (0 to disable)
+#define REPORT_INPUT_AGE 0  // fill the gamepad VendorSpec byte with sequence number and input age (see diva_protocol.h)
+#define PRESS_LATCHING   1  // keep presses shorter than a report interval until they were sent at least once (0 to disable)
+#define BUTTON_SAMPLE_HZ 100000 // PIO button bank sampling rate (0 to poll the GPIOs from core 1 instead)
+#define BUTTON_RING_BITS 8  // log2 of the button sample ring size in bytes (64 samples)
+#define WATCHDOG_TIMEOUT_MS 200 // reboot when a core stops making progress (0 to disable)
+#define SLIDER_STALL_MS  50 // clear the slider and restart the i2c sniffer after this long without a slider reply
+#define RECONNECT_DELAY_MS 100 // how long the device stays detached when the mode switch is toggled
+#define MODE_CHECK_INTERVAL_US 10000 // mode switch polling interval
+#define SLIDER_FILTER_MODE SLIDER_FILTER_PASS // default slider filter (see slider_filter.h), can be changed with a feature report
+#define SLIDER_FILTER_N  2
+#define SLIDER_FILTER_M  3
+#define SLIDE_TRACKING   1  // follow slider contacts and report slide events/velocity (0 to disable)
+#define EVENT_ARM_GUARD_US 150 // event reports wait until the next expected IN token is this close (0 to send right away)
 
 #define PIN_TRIANGLE 28
 #define PIN_SQUARE   27
@@ -96,7 +118,7 @@ const uint g_but_pin[NUM_BUTTONS]  = {PIN_TRIANGLE, PIN_SQUARE, PIN_CROSS, PIN_C
 const uint8_t SW_KEYCODE[] = {HID_KEY_Q, HID_KEY_W, HID_KEY_O, HID_KEY_P};
 const uint8_t SLIDER_KEYCODE[] = {HID_KEY_1, HID_KEY_2, HID_KEY_3, HID_KEY_4, HID_KEY_5, HID_KEY_6, HID_KEY_7, HID_KEY_8, HID_KEY_9, HID_KEY_0, HID_KEY_MINUS, HID_KEY_EQUAL};
 
-uint32_t g_button_state = 0;
+uint32_t g_button_state = 0; // core 1 only
 
 static uint8_t buttonStatus[22] = {0};
 
@@ -110,9 +132,216 @@ typedef struct joy_report_s {
     uint8_t  VendorSpec;
 } joy_report_t;
 
-volatile uint32_t g_full_slider;
+// Words shared between the cores. Both are a single ldr/str on the M0+, the builtins only tell the
+// compiler (and ThreadSanitizer in test/core_stress.c) that the other core reads or writes them too
+#define SHARED_LOAD(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define SHARED_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
 
-static void update_state_joy(uint32_t button_state)
+// Slider state, owned by core 0 and handed to core 1 through a seqlock so that the
+// cells, their timestamps and the slide contacts are always read from the same reply
+typedef struct slider_state_s {
+    uint32_t full_slider; // 32 cells, arcade layout
+    uint32_t frame_us;    // time_us_32() of the last complete 0x59 reply
+    uint32_t change_us;   // time_us_32() of the last reply which changed full_slider
+    uint32_t period_us;   // averaged scan period of the first slider half
+    uint32_t slide_count; // contacts on the slider (SLIDE_TRACKING)
+    uint32_t slide_contact[SLIDE_REPORT_CONTACTS]; // slide_contact_report_t of the first ones
+} slider_state_t;
+
+#define SLIDER_STATE_WORDS (sizeof(slider_state_t) / sizeof(uint32_t))
+
+static slider_state_t s_slider = {0};
+static slider_state_t s_slider_shared = {0};
+static uint32_t s_slider_seq = 0; // odd while core 0 is updating s_slider_shared
+
+// core 0 only
+static void publish_slider()
+{
+    const uint32_t *src = (const uint32_t *)&s_slider;
+    uint32_t *dst = (uint32_t *)&s_slider_shared;
+    uint32_t seq = s_slider_seq;
+    SHARED_STORE(s_slider_seq, seq + 1);
+    __dmb();
+    for (uint i = 0; i < SLIDER_STATE_WORDS; i++)
+        SHARED_STORE(dst[i], src[i]);
+    __dmb();
+    SHARED_STORE(s_slider_seq, seq + 2);
+}
+
+#if INPUT_EVENT_REPORT
+#define HID_INSTANCE_EVENTS 1
+static event_queue_t s_slider_events; // core 0 -> core 1
+static event_queue_t s_button_events; // core 1 only
+static uint8_t s_event_report_seq = 0;
+static bool s_event_in_valid = false;
+static uint32_t s_event_in_us; // last event report completion, phase of the host IN tokens
+static uint32_t s_core1_pass_us = 0; // duration of the last core 1 pass
+
+#define EVENT_POLL_US  1000   // event endpoint polling period (bInterval 1 at full speed)
+#define EVENT_PHASE_US 100000 // the IN token phase is not trusted longer than this after a completion
+
+// core 0 only
+static void push_slider_events(uint32_t prev, uint32_t slider, uint32_t us)
+{
+    uint32_t changed = prev ^ slider;
+    while (changed)
+    {
+        int cell = __builtin_ctz(changed);
+        changed &= changed - 1;
+        event_queue_push(&s_slider_events, us, INPUT_ID_SLIDER(cell), (slider >> cell) & 1);
+    }
+}
+#endif
+
+#if SLIDE_TRACKING
+static slide_tracker_t s_slide_tracker; // core 0 only
+
+// core 0 only, fills the slide contacts of s_slider before it is published
+static void track_slides(uint32_t slider, uint32_t us)
+{
+    slide_event_t events[SLIDE_MAX_CONTACTS * 2];
+    int count = slide_tracker_update(&s_slide_tracker, slider, us, events, count_of(events));
+#if INPUT_EVENT_REPORT
+    for (int i = 0; i < count; i++)
+        event_queue_push(&s_slider_events, us, INPUT_ID_SLIDE(events[i].slot), events[i].state);
+#else
+    (void)count;
+#endif
+
+    uint8_t active = 0;
+    for (int slot = 0; slot < SLIDE_MAX_CONTACTS; slot++)
+    {
+        slide_contact_t *c = &s_slide_tracker.contact[slot];
+        if (!c->active)
+            continue;
+        if (active < SLIDE_REPORT_CONTACTS)
+            s_slider.slide_contact[active] = c->position | ((uint32_t)(uint16_t)c->velocity << 16);
+        active++;
+    }
+    s_slider.slide_count = active;
+}
+#endif
+
+// core 1 only
+static slider_state_t read_slider()
+{
+    slider_state_t state;
+    uint32_t *dst = (uint32_t *)&state;
+    const uint32_t *src = (const uint32_t *)&s_slider_shared;
+    uint32_t seq;
+    do {
+        seq = SHARED_LOAD(s_slider_seq);
+        __dmb();
+        for (uint i = 0; i < SLIDER_STATE_WORDS; i++)
+            dst[i] = SHARED_LOAD(src[i]);
+        __dmb();
+    } while ((seq & 1) || seq != SHARED_LOAD(s_slider_seq));
+    return state;
+}
+static uint32_t s_last_button_edge_us;
+
+// Press latching: every bit newly asserted since the last sent report (rising edge) is kept in the latch
+// until the next report is sent, so a tap shorter than the report interval still reaches the host once.
+// Held inputs are reported from their level only, so releases are never delayed.
+// The slider edges are set by core 0 and collected by core 1, hence the spinlock.
+static spin_lock_t *s_latch_lock;
+static uint32_t s_slider_edges;     // core 0 -> core 1
+static uint32_t s_slider_latch = 0; // core 1 only
+static uint32_t s_button_latch = 0; // core 1 only
+static uint32_t s_latched_presses = 0; // presses that would have been lost without latching
+static uint32_t s_sent_buttons = 0; // inputs carried by the last sent report
+static uint32_t s_sent_slider = 0;
+
+// Startup timing (time_us_32() counts from reset, and from the reconnect after a mode change)
+static uint32_t s_connect_us = 0;
+static uint32_t s_mount_us = 0;
+static uint32_t s_first_report_us = 0;
+
+static uint16_t s_sniffer_restarts = 0;
+
+slider_filter_cfg_t g_slider_filter_cfg = SLIDER_FILTER_CFG(SLIDER_FILTER_MODE, SLIDER_FILTER_N, SLIDER_FILTER_M);
+static slider_history_t s_slider_history[2]; // one per slider half
+uint32_t g_core1_heartbeat = 0;
+
+typedef struct input_snapshot_s {
+    uint32_t buttons;
+    uint32_t slider;
+    uint8_t  latched_only; // presses already released, only present in the latch
+    uint32_t slider_frame_us;
+    uint32_t slider_change_us;
+} input_snapshot_t;
+
+static input_snapshot_t s_snapshot; // inputs the last prepared report was built from
+
+// Input to IN transfer latency: time from the first input change not yet reported
+// to the completion of the report carrying it
+static bool s_change_pending = false;
+static uint32_t s_change_us;
+static bool s_change_inflight = false;
+static uint32_t s_inflight_change_us;
+static uint32_t s_in_latency_min_us = UINT32_MAX;
+static uint32_t s_in_latency_max_us = 0;
+static uint64_t s_in_latency_sum_us = 0;
+static uint32_t s_in_latency_samples = 0;
+
+static inline uint32_t newest_us(uint32_t a, uint32_t b)
+{
+    return ((int32_t)(a - b) > 0) ? a : b;
+}
+
+static void take_input_snapshot()
+{
+    uint32_t buttons = g_button_state;
+    slider_state_t slider_state = read_slider();
+    uint32_t slider = slider_state.full_slider;
+
+    // rising edges seen since the last sent report, the level also catches the ones seen by polling
+    s_button_latch |= buttons & ~s_sent_buttons;
+    uint32_t save = spin_lock_blocking(s_latch_lock);
+    s_slider_latch |= s_slider_edges;
+    s_slider_edges = 0;
+    spin_unlock(s_latch_lock, save);
+    s_slider_latch |= slider & ~s_sent_slider;
+
+    s_snapshot.slider_frame_us = slider_state.frame_us;
+    s_snapshot.slider_change_us = slider_state.change_us;
+    s_snapshot.latched_only = __builtin_popcount(s_button_latch & ~buttons) + __builtin_popcount(s_slider_latch & ~slider);
+#if PRESS_LATCHING
+    s_snapshot.buttons = buttons | s_button_latch;
+    s_snapshot.slider = slider | s_slider_latch;
+#else
+    s_snapshot.buttons = buttons;
+    s_snapshot.slider = slider;
+#endif
+
+    if (!s_change_pending && (s_snapshot.buttons != s_sent_buttons || s_snapshot.slider != s_sent_slider))
+    {
+        s_change_pending = true;
+        s_change_us = newest_us(slider_state.change_us, s_last_button_edge_us);
+    }
+}
+
+// the prepared report was accepted by the USB stack
+static void snapshot_sent()
+{
+    if (!s_first_report_us)
+        s_first_report_us = time_us_32() - s_connect_us;
+    // the report carries every latched edge, core 1 did not collect new ones since the snapshot
+    s_button_latch = 0;
+    s_slider_latch = 0;
+    s_latched_presses += s_snapshot.latched_only;
+
+    s_sent_buttons = s_snapshot.buttons;
+    s_sent_slider = s_snapshot.slider;
+    if (s_change_pending)
+    {
+        s_change_pending = false;
+        s_change_inflight = true;
+        s_inflight_change_us = s_change_us;
+    }
+}
+
+static void update_state_joy(uint32_t button_state, uint32_t slider)
 {
     static uint8_t order[] = {BUTTONX,BUTTONY,BUTTONB,BUTTONA,BUTTONLB,BUTTONRB,BUTTONLT,BUTTONRT,BUTTONSELECT,BUTTONSTART,BUTTONHOME,BUTTONR3,BUTTONL3,BUTTONUP,BUTTONRIGHT,BUTTONDOWN,BUTTONLEFT};
 
@@ -124,7 +353,7 @@ static void update_state_joy(uint32_t button_state)
     }
 
     uint32_t *axis = (uint32_t *)(&(buttonStatus[AXISLX])); // effectively casting LX|LY|RX|RY as a single uint32_t
-    *axis = g_full_slider;
+    *axis = slider;
     *axis ^= 0x80808080; //xor with center stick value for each of the 4 axis
 }
 
@@ -166,22 +395,47 @@ void generate_report_joy(joy_report_t *report){
 }
 
 void prepare_report(){
-    update_state_joy(g_button_state);
+    take_input_snapshot();
+    update_state_joy(s_snapshot.buttons, s_snapshot.slider);
     generate_report_joy(&report);
 }
 
+#if REPORT_INPUT_AGE
+static uint8_t s_report_seq = 0;
+
+static uint32_t input_age_us()
+{
+    uint32_t now = time_us_32();
+    uint32_t slider_age = now - s_snapshot.slider_frame_us;
+    uint32_t button_age = now - s_last_button_edge_us;
+    return (slider_age < button_age) ? slider_age : button_age;
+}
+#endif
+
 void send_hid() {
     if (tud_hid_ready())
     {
-        tud_hid_n_report(0x00, 0x00, &report, sizeof(report));
+#if REPORT_INPUT_AGE
+        report.VendorSpec = input_age_vendor_byte(s_report_seq, input_age_us());
+#endif
+        if (tud_hid_n_report(0x00, 0x00, &report, sizeof(report)))
+        {
+#if REPORT_INPUT_AGE
+            s_report_seq++;
+#endif
+            snapshot_sent();
+        }
     }
 }
 
 uint8_t nkro_report[32] = {0};
 void prepare_report_kb() {
+      take_input_snapshot();
+      uint32_t slider = s_snapshot.slider;
+
       memset(nkro_report, 0, 32);
       for (int i = 0; i < 4; i++) {
-        if ((g_button_state>>i)&1) {
+        if ((s_snapshot.buttons>>i)&1) {
           uint8_t bit = SW_KEYCODE[i] % 8;
           uint8_t byte = (SW_KEYCODE[i] / 8) + 1;
           if (SW_KEYCODE[i] >= 240 && SW_KEYCODE[i] <= 247) {
@@ -192,7 +446,7 @@ void prepare_report_kb() {
         }
       }
 
-      if ((g_full_slider>>29)&7) {
+      if ((slider>>29)&7) {
         uint8_t bit = SLIDER_KEYCODE[0] % 8;
         uint8_t byte = (SLIDER_KEYCODE[0] / 8) + 1;
         if (SLIDER_KEYCODE[0] >= 240 && SLIDER_KEYCODE[0] <= 247) {
@@ -203,7 +457,7 @@ void prepare_report_kb() {
       }
 
       for (int i = 0; i < 12; i++) {
-        if ((g_full_slider>>(27-2*i))&1) {
+        if ((slider>>(27-2*i))&1) {
           uint8_t bit = SLIDER_KEYCODE[i] % 8;
           uint8_t byte = (SLIDER_KEYCODE[i] / 8) + 1;
           if (SLIDER_KEYCODE[i] >= 240 && SLIDER_KEYCODE[i] <= 247) {
@@ -214,7 +468,7 @@ void prepare_report_kb() {
         }
       }
 
-      if (g_full_slider&7) {
+      if (slider&7) {
         uint8_t bit = SLIDER_KEYCODE[11] % 8;
         uint8_t byte = (SLIDER_KEYCODE[11] / 8) + 1;
         if (SLIDER_KEYCODE[11] >= 240 && SLIDER_KEYCODE[11] <= 247) {
@@ -228,11 +482,183 @@ void prepare_report_kb() {
 void send_hid_kb() {
     if (tud_hid_ready())
     {
-        tud_hid_n_report(0x00, 0x00, &nkro_report, sizeof(nkro_report));
+        if (tud_hid_n_report(0x00, 0x00, &nkro_report, sizeof(nkro_report)))
+            snapshot_sent();
+    }
+}
+
+#if BUTTON_SAMPLE_HZ > 0
+// pio1 samples the button bank and pushes changed words, one DMA channel copies them to s_button_ring
+// then chains to a second one which copies the timer to s_button_ts_ring (and chains back)
+#define BUTTON_RING_SIZE ((1 << BUTTON_RING_BITS) / sizeof(uint32_t))
+static uint32_t s_button_ring[BUTTON_RING_SIZE] __attribute__((aligned(1 << BUTTON_RING_BITS)));
+static uint32_t s_button_ts_ring[BUTTON_RING_SIZE] __attribute__((aligned(1 << BUTTON_RING_BITS)));
+static uint s_button_dma_ts;
+static uint32_t s_button_ring_tail = 0;
+static uint32_t s_button_last_us = 0; // timestamp of the last drained sample, still in its slot unless the DMA lapped core 1
+static uint32_t s_button_bank = 0xFFFFFFFF; // latest sample (released buttons are pulled up)
+
+static uint32_t bank_to_buttons(uint32_t bank)
+{
+    uint32_t button_state = 0;
+    for (int i=0; i<NUM_BUTTONS; i++)
+    {
+        if (!((bank >> (g_but_pin[i] - BUTTON_BASE_PIN)) & 1))
+        {
+            button_state |= 1<<(i);
+        }
+    }
+    return button_state;
+}
+
+// Sampled button state, debounced per edge: a face button press is held for DEBOUNCE_US
+// (like the polled debounce), edges seen during the hold only decide the state once it ends
+#define DEBOUNCED_BUTTONS 0x0F // TRIANGLE, SQUARE, CROSS, CIRCLE
+static uint32_t s_button_debounced = 0;
+static uint32_t s_button_hold = 0; // buttons in their press hold
+static uint32_t s_button_hold_end_us[4];
+
+static void button_edge(int i, bool pressed, uint32_t us)
+{
+    if ((s_button_hold >> i) & 1)
+        return;
+
+    s_last_button_edge_us = us;
+    if (pressed)
+    {
+        s_button_debounced |= 1u << i;
+        s_button_latch |= 1u << i;
+    }
+    else
+        s_button_debounced &= ~(1u << i);
+#if INPUT_EVENT_REPORT
+    event_queue_push(&s_button_events, us, INPUT_ID_BUTTON(i), pressed);
+#endif
+#if DEBOUNCE_US > 0
+    if (pressed && ((DEBOUNCED_BUTTONS >> i) & 1))
+    {
+        s_button_hold |= 1u << i;
+        s_button_hold_end_us[i] = us + DEBOUNCE_US;
+    }
+#endif
+}
+
+// ends the holds which are over at us, buttons is the sampled state at that time
+static void end_button_holds(uint32_t buttons, uint32_t us)
+{
+    uint32_t hold = s_button_hold;
+    while (hold)
+    {
+        int i = __builtin_ctz(hold);
+        hold &= hold - 1;
+        if ((int32_t)(us - s_button_hold_end_us[i]) < 0)
+            continue;
+        s_button_hold &= ~(1u << i);
+        if (((buttons ^ s_button_debounced) >> i) & 1)
+            button_edge(i, (buttons >> i) & 1, s_button_hold_end_us[i]);
     }
 }
 
+static void apply_buttons(uint32_t prev, uint32_t buttons, uint32_t us)
+{
+    end_button_holds(prev, us);
+    uint32_t changed = buttons ^ prev;
+    while (changed)
+    {
+        int i = __builtin_ctz(changed);
+        changed &= changed - 1;
+        button_edge(i, (buttons >> i) & 1, us);
+    }
+}
+
+static uint32_t button_ring_head()
+{
+    // the timestamp is written last, entries before it are complete
+    return (dma_hw->ch[s_button_dma_ts].write_addr - (uintptr_t)s_button_ts_ring) / sizeof(uint32_t);
+}
+
+// Consume the samples pushed since last call, one edge per changed button stamped with its sample time
+static void drain_button_samples()
+{
+    uint32_t head = button_ring_head();
+    uint32_t prev = bank_to_buttons(s_button_bank);
+
+    // the last drained sample was overwritten: the DMA went round the ring (possibly an exact number of
+    // times, head == tail), the entries are no continuation of it, only the newest one is kept
+    if (s_button_ts_ring[(s_button_ring_tail + BUTTON_RING_SIZE - 1) % BUTTON_RING_SIZE] != s_button_last_us)
+        s_button_ring_tail = (head + BUTTON_RING_SIZE - 1) % BUTTON_RING_SIZE;
+
+    while (s_button_ring_tail != head)
+    {
+        uint32_t bank = s_button_ring[s_button_ring_tail];
+        uint32_t us = s_button_ts_ring[s_button_ring_tail];
+        uint32_t buttons = bank_to_buttons(bank);
+        apply_buttons(prev, buttons, us);
+        prev = buttons;
+        s_button_bank = bank;
+        s_button_last_us = us;
+        s_button_ring_tail = (s_button_ring_tail + 1) % BUTTON_RING_SIZE;
+    }
+    end_button_holds(prev, time_us_32());
+}
+
+// core 1 (re)start: skip whatever was sampled while core 1 was held in reset, start from the pins
+static void button_sampler_resync()
+{
+    uint32_t head = button_ring_head();
+    s_button_ring_tail = head;
+    s_button_last_us = s_button_ts_ring[(head + BUTTON_RING_SIZE - 1) % BUTTON_RING_SIZE];
+    uint32_t bank = (gpio_get_all() >> BUTTON_BASE_PIN) & ((1u << BUTTON_PIN_COUNT) - 1);
+    apply_buttons(bank_to_buttons(s_button_bank), bank_to_buttons(bank), time_us_32());
+    s_button_bank = bank;
+}
+
+static void button_sampler_init()
+{
+    PIO pio = pio1;
+    uint sm = pio_claim_unused_sm(pio, true);
+    uint offset = pio_add_program(pio, &button_sampler_program);
+    float div = (float)clock_get_hz(clk_sys) / (BUTTON_SAMPLE_HZ * BUTTON_SAMPLE_CYCLES);
+    button_sampler_program_init(pio, sm, offset, div);
+
+    uint dma_sample = dma_claim_unused_channel(true);
+    s_button_dma_ts = dma_claim_unused_channel(true);
+
+    // PIO RX FIFO -> sample ring, paced by the state machine
+    dma_channel_config c = dma_channel_get_default_config(dma_sample);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, BUTTON_RING_BITS);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+    channel_config_set_chain_to(&c, s_button_dma_ts);
+    dma_channel_configure(dma_sample, &c, s_button_ring, &pio->rxf[sm], 1, false);
+
+    // timer -> timestamp ring, unpaced
+    c = dma_channel_get_default_config(s_button_dma_ts);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_ring(&c, true, BUTTON_RING_BITS);
+    channel_config_set_chain_to(&c, dma_sample);
+    dma_channel_configure(s_button_dma_ts, &c, s_button_ts_ring, &timer_hw->timerawl, 1, false);
+
+    dma_channel_start(dma_sample);
+    pio_sm_set_enabled(pio, sm, true);
+}
+
+#else
+static inline bool read_button(int i)
+{
+    return gpio_get(g_but_pin[i]);
+}
+#endif
+
 void update_inputs() {
+#if BUTTON_SAMPLE_HZ > 0
+    drain_button_samples();
+    g_button_state = s_button_debounced;
+#else
     uint32_t button_state = 0;
 #if DEBOUNCE_CYCLES > 0
 
@@ -244,7 +670,7 @@ void update_inputs() {
     {
         if (BOUNCE_CAN_UPDATE(last_change[i]))
         {
-            input = gpio_get(g_but_pin[i]);
+            input = read_button(i);
             if (!input) // only debounce on press (remove condition for debounce on release as well)
             {
                 last_change[i] = DEBOUNCE_CYCLES;
@@ -265,30 +691,121 @@ void update_inputs() {
     for (int i=0; i<NUM_BUTTONS; i++)
 #endif
     {
-        if (!gpio_get(g_but_pin[i]))
+        if (!read_button(i))
         {
             button_state |= 1<<(i);
         }
     }
 
+    if (button_state != g_button_state)
+        s_last_button_edge_us = time_us_32();
+#if INPUT_EVENT_REPORT
+    uint32_t changed = button_state ^ g_button_state;
+    while (changed)
+    {
+        int i = __builtin_ctz(changed);
+        changed &= changed - 1;
+        event_queue_push(&s_button_events, s_last_button_edge_us, INPUT_ID_BUTTON(i), (button_state >> i) & 1);
+    }
+#endif
     g_button_state = button_state;
+#endif
 }
 
-void core1_usbtask() {
-    void (*prepare_hid)() = g_kb_mode ? &prepare_report_kb : &prepare_report;
-    void (*process_hid)() = g_kb_mode ? &send_hid_kb : &send_hid;
+#if INPUT_EVENT_REPORT
+// Send every queued input change, oldest first, as soon as the event endpoint is free
+// Once armed, the endpoint is busy until the host's next IN token: arming it as soon as an event is
+// pending makes the other events of that polling interval wait one more poll. Arm just before the
+// token instead, its phase being the last event report completion.
+static bool event_token_due()
+{
+#if EVENT_ARM_GUARD_US > 0
+    uint32_t since = time_us_32() - s_event_in_us;
+    if (s_event_in_valid && since < EVENT_PHASE_US)
+        return EVENT_POLL_US - since % EVENT_POLL_US <= EVENT_ARM_GUARD_US + s_core1_pass_us; // no later pass before the token
+#endif
+    return true;
+}
+
+void send_event_report() {
+    if (!tud_hid_n_ready(HID_INSTANCE_EVENTS))
+        return;
+
+    event_report_t event_report = {0};
+    uint32_t button_count = 0;
+    uint32_t slider_count = 0;
+    while (event_report.count < EVENT_REPORT_EVENTS)
+    {
+        const timed_event_t *button_ev = event_queue_peek(&s_button_events, button_count);
+        const timed_event_t *slider_ev = event_queue_peek(&s_slider_events, slider_count);
+        const timed_event_t *ev = (button_ev && (!slider_ev || (int32_t)(button_ev->us - slider_ev->us) <= 0)) ? button_ev : slider_ev;
+        if (!ev)
+            break;
+
+        if (!event_report.count)
+            event_report.base_us = ev->us;
+        else if (ev->us - event_report.base_us > UINT16_MAX)
+            break; // next report
+
+        input_event_t *out = &event_report.events[event_report.count++];
+        out->dt_us = ev->us - event_report.base_us;
+        out->id = ev->id;
+        out->state = ev->state;
+        if (ev == button_ev)
+            button_count++;
+        else
+            slider_count++;
+    }
+
+    if (!event_report.count || !event_token_due())
+        return;
+
+    event_report.seq = s_event_report_seq;
+    event_report.dropped = event_queue_dropped(&s_slider_events) + event_queue_dropped(&s_button_events);
+    if (tud_hid_n_report(HID_INSTANCE_EVENTS, 0x00, &event_report, sizeof(event_report)))
+    {
+        s_event_report_seq++;
+        event_queue_pop(&s_button_events, button_count);
+        event_queue_pop(&s_slider_events, slider_count);
+    }
+}
+#endif
+
+// one pass of the core 1 loop (also driven directly by the host tests in test/)
+void core1_poll() {
     static uint64_t last_update = 0;
-    while (true) {
-        uint64_t curr_time = time_us_64();
-        tud_task();
-        update_inputs();
-        prepare_hid();
-        if ( curr_time - last_update > 900 )
-        {
-            process_hid();
-            last_update = curr_time;
-        }
+    uint64_t curr_time = time_us_64();
+#if INPUT_EVENT_REPORT
+    static uint64_t last_pass = 0;
+    s_core1_pass_us = (uint32_t)(curr_time - last_pass);
+    last_pass = curr_time;
+#endif
+    SHARED_STORE(g_core1_heartbeat, g_core1_heartbeat + 1);
+    tud_task();
+    update_inputs();
+    if (g_kb_mode)
+        prepare_report_kb();
+    else
+        prepare_report();
+    if ( curr_time - last_update > 900 )
+    {
+        if (g_kb_mode)
+            send_hid_kb();
+        else
+            send_hid();
+        last_update = curr_time;
     }
+#if INPUT_EVENT_REPORT
+    send_event_report();
+#endif
+}
+
+void core1_usbtask() {
+#if BUTTON_SAMPLE_HZ > 0
+    button_sampler_resync();
+#endif
+    while (true)
+        core1_poll();
 }
 
 void init_pins()
@@ -307,21 +824,36 @@ void init_pins()
     gpio_pull_up(PIN_MODESWITCH);
 }
 
-int main()
-{
-    set_sys_clock_khz(200000, true);
-    init_pins();
-    board_init();
+// i2c sniffer state machines on pio0 and Ipega slider decode state, core 0 only
+static uint s_sniffer_sm[4];
+static uint s_sniffer_offset[4];
+static uint32_t s_sniffer_mask;
+#if WATCHDOG_TIMEOUT_MS > 0
+static uint32_t s_last_heartbeat;
+#endif
 
-    if (!gpio_get(PIN_HOME) && !gpio_get(PIN_CIRCLE))
-    {
-        reset_usb_boot(0, 0);
-    }
+typedef struct decode_state_s {
+    bool     just_started;
+    uint8_t  readidx;
+    uint8_t  addr;
+    uint8_t  curr_half;
+    uint8_t  offset;
+    uint32_t scan;      // cells touched in the current half scan
+    uint32_t scan_mask; // cells covered by the current half scan
+    uint32_t next_mode_check;
+    uint32_t stall_ref;
+} decode_state_t;
 
-    g_kb_mode = gpio_get(PIN_MODESWITCH); // NORMAL: keyboard mode, ARCADE: gamepad mode
+static decode_state_t s_decode = {0};
 
-    tusb_init();
+// lookup tables for quick update of the half scan, coordinates coincide with readidx (readidx+8 for the second half)
+// ipega has 18 zones instead of 32, so part of the slider is doubled to scale : 18 zones = 1+1+14+1+1 ==> 1+1+ 2*14 +1+1 = 32 zones
+// ( 1 2 33 44 .. 15 15 16 16 17 18 )
+static const uint32_t s_tabf0[17] = {0, 1u<<31, 3<<28,0, 3<<26, 3<<22,0, 3<<20, 3<<16, 3<<14, 3<<10, 0, 3<<8, 3<<4, 0, 3<<2, 1};
+static const uint32_t s_tab0f[16] = {0, 1<<30, 0, 0, 3<<24, 0, 0, 3<<18, 0, 3<<12, 0, 0, 3<<6, 0, 0, 1<<1};
 
+static void sniffer_init()
+{
     // Full speed for the PIO clock divider
     float div = 1;
     PIO pio = pio0;
@@ -343,115 +875,265 @@ int main()
     uint offset_stop = pio_add_program(pio, &i2c_stop_program);
     i2c_stop_program_init(pio, sm_stop, offset_stop, div);
 
+    s_sniffer_sm[0] = sm_main;
+    s_sniffer_sm[1] = sm_data;
+    s_sniffer_sm[2] = sm_start;
+    s_sniffer_sm[3] = sm_stop;
+    s_sniffer_offset[0] = offset_main;
+    s_sniffer_offset[1] = offset_data;
+    s_sniffer_offset[2] = offset_start;
+    s_sniffer_offset[3] = offset_stop;
+    s_sniffer_mask = (1u<<sm_main) | (1u<<sm_data) | (1u<<sm_start) | (1u<<sm_stop);
+
     // Start running our PIO program in the state machine
     pio_sm_set_enabled(pio, sm_main, true);
     pio_sm_set_enabled(pio, sm_start, true);
     pio_sm_set_enabled(pio, sm_stop, true);
     pio_sm_set_enabled(pio, sm_data, true);
 
-    multicore_launch_core1(core1_usbtask);
+    s_decode.stall_ref = time_us_32();
+}
+
+// one pass of the core 0 loop: mode switch, slider stall recovery or one sniffer word (also driven by the host tests)
+void core0_poll() {
+    uint32_t now = time_us_32();
+
+#if WATCHDOG_TIMEOUT_MS > 0
+    // only feed the watchdog while core 1 is alive too
+    uint32_t heartbeat = SHARED_LOAD(g_core1_heartbeat);
+    if (heartbeat != s_last_heartbeat)
+    {
+        s_last_heartbeat = heartbeat;
+        watchdog_update();
+    }
+#endif
 
-    // Ipega slider decode loop
-    bool just_started = false;
-    uint8_t readidx = 0;
-    uint8_t addr = 0;
-    uint8_t curr_half = 0;
-    uint8_t offset = 0;
-
-    // lookup tables for quick update of g_full_slider, coordinates coincide with readidx (readidx+8 for the second half)
-    // ipega has 18 zones instead of 32, so part of the slider is doubled to scale : 18 zones = 1+1+14+1+1 ==> 1+1+ 2*14 +1+1 = 32 zones
-    // ( 1 2 33 44 .. 15 15 16 16 17 18 )
-    const uint32_t tabf0[17] = {0, 1<<31, 3<<28,0, 3<<26, 3<<22,0, 3<<20, 3<<16, 3<<14, 3<<10, 0, 3<<8, 3<<4, 0, 3<<2, 1};
-    const uint32_t tab0f[16] = {0, 1<<30, 0, 0, 3<<24, 0, 0, 3<<18, 0, 3<<12, 0, 0, 3<<6, 0, 0, 1<<1};
-
-    uint8_t cooldown = 255;
-    while (true) {
-        cooldown--;
-        if (!cooldown && gpio_get(PIN_MODESWITCH) != g_kb_mode)
+    if ((int32_t)(now - s_decode.next_mode_check) >= 0)
+    {
+        s_decode.next_mode_check = now + MODE_CHECK_INTERVAL_US;
+        if (gpio_get(PIN_MODESWITCH) != g_kb_mode)
         {
             /* change mode */
             multicore_reset_core1();
-            while (!tud_disconnect()){
-            sleep_ms(1000);
-            };
+            spin_unlock_unsafe(s_latch_lock); // core 1 might have been reset while holding it
+            tud_disconnect();
+            watchdog_update();
+            sleep_ms(RECONNECT_DELAY_MS); // long enough for the host to see the detach
+            watchdog_update();
             g_kb_mode = gpio_get(PIN_MODESWITCH);
-            sleep_ms(1000);
+            s_connect_us = time_us_32();
+            s_mount_us = 0;
+            s_first_report_us = 0;
             tud_connect();
-            sleep_ms(1000);
             multicore_launch_core1(core1_usbtask);
-            tud_task();
-            cooldown = 255;
+            return;
         }
+    }
 
-        uint32_t val = pio_sm_get_blocking(pio, sm_main);
-
-        // The format of the uint32_t returned by the sniffer is composed of two event
-        // code bits (EV1 = Bit12, EV0 = Bit11), and when it comes to data, the nine least
-        // significant bits correspond to (ACK = Bit0), and the value 8 bits
-        // where (B0 = Bit1 and B7 = Bit8).
-        uint32_t ev_code = (val >> 10) & 0x03;
-        uint8_t  data = ((val >> 1) & 0xFF);
-        //bool ack = !(val&1);
-
-        if (ev_code == EV_START) {
-            just_started = true;
-        } else if (ev_code == EV_STOP) {
-            addr = 0;
-        } else if (ev_code == EV_DATA) {
-            if (just_started)
+    if (pio_sm_is_rx_fifo_empty(pio0, s_sniffer_sm[0]))
+    {
+        // Ipega MCU stopped scanning (or the sniffer lost sync): drop the stale touch data and restart decoding
+        uint32_t last_frame = s_slider.frame_us;
+        if ((int32_t)(last_frame - s_decode.stall_ref) > 0)
+            s_decode.stall_ref = last_frame;
+        if (now - s_decode.stall_ref > SLIDER_STALL_MS * 1000)
+        {
+#if INPUT_EVENT_REPORT
+            push_slider_events(s_slider.full_slider, 0, now);
+#endif
+            s_slider.full_slider = 0;
+            s_slider.change_us = now;
+#if SLIDE_TRACKING
+            track_slides(0, now);
+#endif
+            publish_slider();
+            slider_filter_reset(&s_slider_history[0]);
+            slider_filter_reset(&s_slider_history[1]);
+            pio_set_sm_mask_enabled(pio0, s_sniffer_mask, false);
+            for (int i = 0; i < 4; i++)
             {
-                addr = data;
-                readidx = 0;
-                just_started = false;
+                pio_sm_clear_fifos(pio0, s_sniffer_sm[i]);
+                pio_sm_restart(pio0, s_sniffer_sm[i]);
+                pio_sm_exec(pio0, s_sniffer_sm[i], pio_encode_jmp(s_sniffer_offset[i]));
             }
-            else if (addr == 0x58) // slider read request (data is slider half)
-            {
-                curr_half = data;
-                if (curr_half == 1)
-                    offset = 0;
-                else
-                    offset = 8;
-            } else if (addr == 0x59) // slider read reply (9 bytes of data will follow)
+            pio_interrupt_clear(pio0, IRQ_EVENT);
+            pio_enable_sm_mask_in_sync(pio0, s_sniffer_mask);
+            s_decode.just_started = false;
+            s_decode.addr = 0;
+            s_decode.readidx = 0;
+            s_decode.stall_ref = now;
+            SHARED_STORE(s_sniffer_restarts, s_sniffer_restarts + 1);
+        }
+        return;
+    }
+
+    uint32_t val = pio_sm_get(pio0, s_sniffer_sm[0]);
+
+    // The format of the uint32_t returned by the sniffer is composed of two event
+    // code bits (EV1 = Bit12, EV0 = Bit11), and when it comes to data, the nine least
+    // significant bits correspond to (ACK = Bit0), and the value 8 bits
+    // where (B0 = Bit1 and B7 = Bit8).
+    uint32_t ev_code = (val >> 10) & 0x03;
+    uint8_t  data = ((val >> 1) & 0xFF);
+    //bool ack = !(val&1);
+
+    if (ev_code == EV_START) {
+        s_decode.just_started = true;
+    } else if (ev_code == EV_STOP) {
+        if (s_decode.addr == 0x59)
+        {
+            // filter the complete half s_decode.scan and publish it in a single store
+            uint32_t filtered = slider_filter_apply(&s_slider_history[s_decode.offset ? 1 : 0], SHARED_LOAD(g_slider_filter_cfg), s_decode.scan, now);
+            uint32_t slider = (s_slider.full_slider & ~s_decode.scan_mask) | (filtered & s_decode.scan_mask);
+            uint32_t frame_us = time_us_32();
+            uint32_t rising = slider & ~s_slider.full_slider;
+            if (slider != s_slider.full_slider)
+                s_slider.change_us = frame_us;
+#if INPUT_EVENT_REPORT
+            push_slider_events(s_slider.full_slider, slider, frame_us);
+#endif
+            s_slider.full_slider = slider;
+            s_slider.frame_us = frame_us;
+            s_slider.period_us = s_slider_history[0].period_us;
+#if SLIDE_TRACKING
+            track_slides(slider, frame_us);
+#endif
+            publish_slider();
+            if (rising)
             {
-                switch (readidx){
-                    case 1:
-                    case 4:
-                    case 7:
-                        if (data & 0x0f)
-                        {
-                            g_full_slider |= tab0f[readidx + offset];
-                        } else {
-                            g_full_slider &= ~(tab0f[readidx + offset]);
-                        }
-                        /* fallthrough*/
-                    case 2:
-                    case 5:
-                    case 8:
-                        if (data & 0xf0)
-                        {
-                            g_full_slider  |= tabf0[readidx + offset];
-                        } else {
-                            g_full_slider &= ~(tabf0[readidx + offset]);
-                        }
-                    default:
-                        break;
-                }
+                uint32_t save = spin_lock_blocking(s_latch_lock);
+                s_slider_edges |= rising;
+                spin_unlock(s_latch_lock, save);
             }
-            readidx++;
         }
+        s_decode.addr = 0;
+    } else if (ev_code == EV_DATA) {
+        if (s_decode.just_started)
+        {
+            s_decode.addr = data;
+            s_decode.readidx = 0;
+            s_decode.scan = 0;
+            s_decode.scan_mask = 0;
+            s_decode.just_started = false;
+        }
+        else if (s_decode.addr == 0x58) // slider read request (data is slider half)
+        {
+            s_decode.curr_half = data;
+            if (s_decode.curr_half == 1)
+                s_decode.offset = 0;
+            else
+                s_decode.offset = 8;
+        } else if (s_decode.addr == 0x59) // slider read reply (9 bytes of data will follow)
+        {
+            switch (s_decode.readidx){
+                case 1:
+                case 4:
+                case 7:
+                    s_decode.scan_mask |= s_tab0f[s_decode.readidx + s_decode.offset];
+                    if (data & 0x0f)
+                    {
+                        s_decode.scan |= s_tab0f[s_decode.readidx + s_decode.offset];
+                    }
+                    /* fallthrough*/
+                case 2:
+                case 5:
+                case 8:
+                    s_decode.scan_mask |= s_tabf0[s_decode.readidx + s_decode.offset];
+                    if (data & 0xf0)
+                    {
+                        s_decode.scan |= s_tabf0[s_decode.readidx + s_decode.offset];
+                    }
+                default:
+                    break;
+            }
+        }
+        s_decode.readidx++;
+    }
+}
+
+int main()
+{
+    set_sys_clock_khz(200000, true);
+    init_pins();
+    board_init();
+
+    if (!gpio_get(PIN_HOME) && !gpio_get(PIN_CIRCLE))
+    {
+        reset_usb_boot(0, 0);
     }
+
+    g_kb_mode = gpio_get(PIN_MODESWITCH); // NORMAL: keyboard mode, ARCADE: gamepad mode
+
+    s_latch_lock = spin_lock_init(spin_lock_claim_unused(true));
+
+    tusb_init();
+
+    // start servicing USB right away, the i2c sniffer is not needed for enumeration
+#if BUTTON_SAMPLE_HZ > 0
+    button_sampler_init();
+#endif
+    multicore_launch_core1(core1_usbtask);
+
+    sniffer_init();
+
+#if WATCHDOG_TIMEOUT_MS > 0
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+    s_last_heartbeat = SHARED_LOAD(g_core1_heartbeat);
+#endif
+
+    while (true)
+        core0_poll();
 }
 
 
+// Invoked when device is mounted (configured)
+void tud_mount_cb(void) {
+    s_mount_us = time_us_32() - s_connect_us;
+}
+
+// Invoked when sent REPORT successfully to host
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report,
+                                uint16_t len) {
+    (void)report;
+    (void)len;
+
+#if INPUT_EVENT_REPORT
+    if (instance == HID_INSTANCE_EVENTS)
+    {
+        // event report entries are released as soon as they are queued
+        s_event_in_us = time_us_32();
+        s_event_in_valid = true;
+        return;
+    }
+#endif
+    if (instance != 0)
+        return;
+
+    if (s_change_inflight)
+    {
+        uint32_t latency = time_us_32() - s_inflight_change_us;
+        if (latency < s_in_latency_min_us)
+            s_in_latency_min_us = latency;
+        if (latency > s_in_latency_max_us)
+            s_in_latency_max_us = latency;
+        s_in_latency_sum_us += latency;
+        s_in_latency_samples++;
+        s_change_inflight = false;
+    }
+}
+
 // Invoked when received SET_REPORT control request or
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t itf, uint8_t report_id,
                            hid_report_type_t report_type, uint8_t const* buffer,
                            uint16_t bufsize) {
     (void)itf;
-    if (report_type == HID_REPORT_TYPE_FEATURE)
+    if (report_type == HID_REPORT_TYPE_FEATURE && report_id == 0 && bufsize >= sizeof(slider_filter_report_t))
     {
-        /* someday */
+        const slider_filter_report_t *req = (const slider_filter_report_t *)buffer;
+        slider_filter_cfg_t cfg = SLIDER_FILTER_CFG(req->mode, req->n, req->m);
+        if (slider_filter_cfg_valid(cfg))
+            SHARED_STORE(g_slider_filter_cfg, cfg);
     }
 }
 
@@ -462,10 +1144,52 @@ uint16_t tud_hid_get_report_cb(uint8_t itf, uint8_t report_id,
                                hid_report_type_t report_type, uint8_t* buffer,
                                uint16_t reqlen) {
     (void)itf;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)reqlen;
+
+    if (report_type == HID_REPORT_TYPE_FEATURE && report_id == 0)
+    {
+        diag_report_t diag = {0};
+        diag.version = DIAG_REPORT_VERSION;
+        diag.size = sizeof(diag_report_t);
+        diag.latched_presses = s_latched_presses;
+        diag.mount_us = s_mount_us;
+        diag.first_report_us = s_first_report_us;
+        diag.sniffer_restarts = SHARED_LOAD(s_sniffer_restarts);
+        diag.watchdog_reboot = watchdog_caused_reboot();
+
+        slider_state_t slider = read_slider();
+        slider_filter_cfg_t cfg = SHARED_LOAD(g_slider_filter_cfg);
+        uint32_t period_us = slider.period_us;
+        diag.filter.mode = SLIDER_FILTER_CFG_MODE(cfg);
+        diag.filter.n = SLIDER_FILTER_CFG_N(cfg);
+        diag.filter.m = SLIDER_FILTER_CFG_M(cfg);
+        uint32_t press_us = slider_filter_press_latency(cfg) * period_us;
+        uint32_t release_us = slider_filter_release_latency(cfg) * period_us;
+        diag.filter_press_us = (press_us > UINT16_MAX) ? UINT16_MAX : press_us;
+        diag.filter_release_us = (release_us > UINT16_MAX) ? UINT16_MAX : release_us;
+        diag.scan_period_us = (period_us > UINT16_MAX) ? UINT16_MAX : period_us;
+
+        if (s_in_latency_samples)
+        {
+            diag.in_latency_min_us = (s_in_latency_min_us > UINT16_MAX) ? UINT16_MAX : s_in_latency_min_us;
+            diag.in_latency_avg_us = (s_in_latency_sum_us / s_in_latency_samples > UINT16_MAX) ? UINT16_MAX : s_in_latency_sum_us / s_in_latency_samples;
+            diag.in_latency_max_us = (s_in_latency_max_us > UINT16_MAX) ? UINT16_MAX : s_in_latency_max_us;
+        }
+        diag.in_latency_samples = s_in_latency_samples;
+
+#if SLIDE_TRACKING
+        diag.slide_contacts = slider.slide_count;
+        for (int i = 0; i < SLIDE_REPORT_CONTACTS && i < diag.slide_contacts; i++)
+        {
+            uint32_t contact = slider.slide_contact[i];
+            diag.slide[i].position = contact & 0xFFFF;
+            diag.slide[i].velocity = (int16_t)(contact >> 16);
+        }
+#endif
+
+        uint16_t len = (reqlen < sizeof(diag)) ? reqlen : sizeof(diag);
+        memcpy(buffer, &diag, len);
+        return len;
+    }
 
     return 0;
 }
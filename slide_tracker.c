@@ -0,0 +1,130 @@
+/**
+ * Ipega Diva Plus (C) CrazyRedMachine 2025
+ *
+ * Slide direction and velocity tracking on the decoded slider
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "slide_tracker.h"
+
+#define MAX_RUNS 16 // at most 16 separate runs fit in 32 cells
+
+static int find_runs(uint32_t slider, uint16_t *position)
+{
+    int count = 0;
+    int start = -1;
+    for (int cell = 0; cell <= 32; cell++)
+    {
+        bool set = (cell < 32) && ((slider >> (31 - cell)) & 1);
+        if (set && start < 0)
+        {
+            start = cell;
+        }
+        else if (!set && start >= 0)
+        {
+            position[count++] = (start + cell - 1) * 128; // center, in 1/256 cell
+            start = -1;
+        }
+    }
+    return count;
+}
+
+static int emit(slide_event_t *events, int count, int max, int slot, uint8_t type, slide_contact_t *c)
+{
+    if (count < max)
+    {
+        events[count].slot = slot;
+        events[count].state = SLIDE_STATE(type, c->cell, c->velocity < 0);
+        count++;
+    }
+    return count;
+}
+
+int slide_tracker_update(slide_tracker_t *t, uint32_t slider, uint32_t now_us, slide_event_t *events, int max)
+{
+    uint16_t position[MAX_RUNS];
+    bool matched[MAX_RUNS] = {0};
+    int runs = find_runs(slider, position);
+    int count = 0;
+
+    for (int slot = 0; slot < SLIDE_MAX_CONTACTS; slot++)
+    {
+        slide_contact_t *c = &t->contact[slot];
+        if (!c->active)
+            continue;
+
+        // nearest unclaimed run
+        int best = -1;
+        int best_dist = SLIDE_MAX_JUMP + 1;
+        for (int i = 0; i < runs; i++)
+        {
+            int dist = abs((int)position[i] - (int)c->position);
+            if (!matched[i] && dist < best_dist)
+            {
+                best = i;
+                best_dist = dist;
+            }
+        }
+
+        if (best < 0)
+        {
+            if (c->sliding)
+                count = emit(events, count, max, slot, SLIDE_ENDED, c);
+            c->active = false;
+            continue;
+        }
+
+        matched[best] = true;
+        c->position = position[best];
+        int travel = (int)c->position - (int)c->move_position;
+        int needed = SLIDE_MIN_TRAVEL;
+        if (c->sliding && (travel < 0) != (c->velocity < 0))
+            needed = 2 * SLIDE_MIN_TRAVEL; // reversing
+        c->confirm = (abs(travel) >= needed) ? c->confirm + 1 : 0;
+        bool crossed = c->confirm >= SLIDE_CONFIRM;
+        if (crossed)
+        {
+            uint32_t dt = now_us - c->move_us;
+            if (dt)
+            {
+                int32_t velocity = travel * 15625 / 4 / (int32_t)dt; // (1/256 cell)/us to cell/s
+                c->velocity = (velocity > INT16_MAX) ? INT16_MAX : (velocity < -INT16_MAX) ? -INT16_MAX : velocity;
+            }
+            c->cell = (c->position + 128) >> 8;
+            c->move_position = c->position;
+            c->move_us = now_us;
+            c->confirm = 0;
+            count = emit(events, count, max, slot, c->sliding ? SLIDE_CONTINUED : SLIDE_STARTED, c);
+            c->sliding = true;
+        }
+        else if (c->sliding && now_us - c->move_us > SLIDE_STILL_US)
+        {
+            count = emit(events, count, max, slot, SLIDE_ENDED, c);
+            c->sliding = false;
+            c->velocity = 0;
+        }
+    }
+
+    // new contacts
+    for (int i = 0; i < runs; i++)
+    {
+        if (matched[i])
+            continue;
+        for (int slot = 0; slot < SLIDE_MAX_CONTACTS; slot++)
+        {
+            slide_contact_t *c = &t->contact[slot];
+            if (c->active)
+                continue;
+            memset(c, 0, sizeof(slide_contact_t));
+            c->active = true;
+            c->position = position[i];
+            c->cell = (c->position + 128) >> 8;
+            c->move_position = c->position;
+            c->move_us = now_us;
+            break;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,45 @@
+#ifndef SLIDE_TRACKER_H_
+#define SLIDE_TRACKER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "diva_protocol.h"
+
+#define SLIDE_MAX_CONTACTS 4        // contacts tracked at once (SLIDE_ENDED for the others is never sent)
+#define SLIDE_MAX_JUMP     (4 * 256) // farthest a contact can move between two scans and still be the same one
+#define SLIDE_STILL_US     50000    // a sliding contact which did not cross a boundary for this long has stopped
+#define SLIDE_MIN_TRAVEL   (2 * 256) // one Ipega zone (a cell pair), travel for a crossing
+#define SLIDE_CONFIRM      2        // consecutive updates a crossing has to hold before it counts
+
+/* Follows contacts (runs of touched cells) across slider updates and emits SLIDE_* events.
+ * Interior Ipega zones are cell pairs, so a finger going to the next zone moves its center by
+ * SLIDE_MIN_TRAVEL and touching both zones moves it by half of that. A crossing is a move of at
+ * least SLIDE_MIN_TRAVEL from the last crossing which holds for SLIDE_CONFIRM updates: a finger
+ * resting on a zone border only reaches the other zone for single scans. Reversing a slide takes
+ * twice the travel. Positions are fixed-point, 1/256 cell, cell 0 being the leftmost one.
+ */
+typedef struct slide_contact_s {
+    bool     active;
+    bool     sliding;
+    uint16_t position;      // current center
+    uint8_t  cell;          // cell of the center at the last crossing
+    uint8_t  confirm;       // consecutive updates past the crossing travel
+    int16_t  velocity;      // cells per second, positive to the right
+    uint16_t move_position; // center at the last crossing (or contact start)
+    uint32_t move_us;       // time the last boundary was crossed (or contact start)
+} slide_contact_t;
+
+typedef struct slide_tracker_s {
+    slide_contact_t contact[SLIDE_MAX_CONTACTS];
+} slide_tracker_t;
+
+typedef struct slide_event_s {
+    uint8_t slot;  // contact index, INPUT_ID_SLIDE(slot)
+    uint8_t state; // SLIDE_STATE()
+} slide_event_t;
+
+// feed the 32 cells slider (bit 31 is the leftmost cell), returns the number of events written
+int slide_tracker_update(slide_tracker_t *t, uint32_t slider, uint32_t now_us, slide_event_t *events, int max);
+
+#endif /* SLIDE_TRACKER_H_ */
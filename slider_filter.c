@@ -0,0 +1,130 @@
+/**
+ * Ipega Diva Plus (C) CrazyRedMachine 2025
+ *
+ * Bit-parallel temporal filter for the slider scans
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "slider_filter.h"
+
+#define SCAN_AGO(h, k) ((h)->scan[((h)->head + SLIDER_HISTORY - (k)) % SLIDER_HISTORY])
+
+bool slider_filter_cfg_valid(slider_filter_cfg_t cfg)
+{
+    uint8_t n = SLIDER_FILTER_CFG_N(cfg);
+    uint8_t m = SLIDER_FILTER_CFG_M(cfg);
+
+    switch (SLIDER_FILTER_CFG_MODE(cfg))
+    {
+        case SLIDER_FILTER_PASS:
+            return true;
+        case SLIDER_FILTER_MAJORITY:
+            return n >= 1 && n <= m && m <= SLIDER_HISTORY;
+        case SLIDER_FILTER_ASYMMETRIC:
+            return n >= 1 && n <= SLIDER_HISTORY && m >= 1 && m <= SLIDER_HISTORY;
+        default:
+            return false;
+    }
+}
+
+void slider_filter_reset(slider_history_t *h)
+{
+    uint32_t period_us = h->period_us;
+    memset(h, 0, sizeof(slider_history_t));
+    h->period_us = period_us;
+}
+
+// cells set in at least n of the last m scans
+static uint32_t majority(slider_history_t *h, uint8_t n, uint8_t m)
+{
+    // bit-sliced counter, c[b] holds bit b of every cell's count
+    uint32_t c[4] = {0};
+    for (int k = 0; k < m; k++)
+    {
+        uint32_t x = SCAN_AGO(h, k);
+        for (int b = 0; b < 3; b++)
+        {
+            uint32_t carry = c[b] & x;
+            c[b] ^= x;
+            x = carry;
+        }
+        c[3] |= x;
+    }
+
+    // count >= n, compared MSB first
+    uint32_t gt = 0;
+    uint32_t eq = 0xFFFFFFFF;
+    for (int b = 3; b >= 0; b--)
+    {
+        uint32_t nb = ((n >> b) & 1) ? 0xFFFFFFFF : 0;
+        gt |= eq & c[b] & ~nb;
+        eq &= ~(c[b] ^ nb);
+    }
+    return gt | eq;
+}
+
+static uint32_t asymmetric(slider_history_t *h, uint8_t press, uint8_t release)
+{
+    uint32_t all = 0xFFFFFFFF;
+    for (int k = 0; k < press; k++)
+        all &= SCAN_AGO(h, k);
+
+    uint32_t any = 0;
+    for (int k = 0; k < release; k++)
+        any |= SCAN_AGO(h, k);
+
+    return all | (h->out & any);
+}
+
+uint32_t slider_filter_apply(slider_history_t *h, slider_filter_cfg_t cfg, uint32_t scan, uint32_t now_us)
+{
+    if (h->last_us)
+    {
+        uint32_t period = now_us - h->last_us;
+        h->period_us = h->period_us ? (h->period_us * 7 + period) / 8 : period;
+    }
+    h->last_us = now_us;
+
+    h->head = (h->head + 1) % SLIDER_HISTORY;
+    h->scan[h->head] = scan;
+
+    switch (SLIDER_FILTER_CFG_MODE(cfg))
+    {
+        case SLIDER_FILTER_MAJORITY:
+            h->out = majority(h, SLIDER_FILTER_CFG_N(cfg), SLIDER_FILTER_CFG_M(cfg));
+            break;
+        case SLIDER_FILTER_ASYMMETRIC:
+            h->out = asymmetric(h, SLIDER_FILTER_CFG_N(cfg), SLIDER_FILTER_CFG_M(cfg));
+            break;
+        default:
+            h->out = scan;
+            break;
+    }
+    return h->out;
+}
+
+uint8_t slider_filter_press_latency(slider_filter_cfg_t cfg)
+{
+    switch (SLIDER_FILTER_CFG_MODE(cfg))
+    {
+        case SLIDER_FILTER_MAJORITY:
+        case SLIDER_FILTER_ASYMMETRIC:
+            return SLIDER_FILTER_CFG_N(cfg) - 1;
+        default:
+            return 0;
+    }
+}
+
+uint8_t slider_filter_release_latency(slider_filter_cfg_t cfg)
+{
+    switch (SLIDER_FILTER_CFG_MODE(cfg))
+    {
+        case SLIDER_FILTER_MAJORITY:
+            return SLIDER_FILTER_CFG_M(cfg) - SLIDER_FILTER_CFG_N(cfg);
+        case SLIDER_FILTER_ASYMMETRIC:
+            return SLIDER_FILTER_CFG_M(cfg) - 1;
+        default:
+            return 0;
+    }
+}
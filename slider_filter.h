@@ -0,0 +1,42 @@
+#ifndef SLIDER_FILTER_H_
+#define SLIDER_FILTER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "diva_protocol.h"
+
+#define SLIDER_HISTORY 8 // scans kept per slider half, upper bound for m
+
+/* Temporal filter applied to each slider half scan before it reaches g_full_slider.
+ * All 32 cells are processed at once with bitwise operations.
+ *
+ * SLIDER_FILTER_PASS       : raw scan
+ * SLIDER_FILTER_MAJORITY   : cell is touched when set in at least n of the last m scans
+ * SLIDER_FILTER_ASYMMETRIC : press needs n consecutive touched scans, release needs m consecutive clear scans
+ */
+typedef struct slider_history_s {
+    uint32_t scan[SLIDER_HISTORY]; // raw scans ring, scan[head] is the newest
+    uint8_t  head;
+    uint32_t out;                  // last filtered value
+    uint32_t last_us;              // time of the last scan
+    uint32_t period_us;            // averaged scan period
+} slider_history_t;
+
+// packed slider_filter_report_t, so core 1 can change it in a single store
+typedef uint32_t slider_filter_cfg_t;
+
+#define SLIDER_FILTER_CFG(mode, n, m) ((uint32_t)(mode) | ((uint32_t)(n) << 8) | ((uint32_t)(m) << 16))
+#define SLIDER_FILTER_CFG_MODE(cfg) ((uint8_t)(cfg))
+#define SLIDER_FILTER_CFG_N(cfg)    ((uint8_t)((cfg) >> 8))
+#define SLIDER_FILTER_CFG_M(cfg)    ((uint8_t)((cfg) >> 16))
+
+bool slider_filter_cfg_valid(slider_filter_cfg_t cfg);
+void slider_filter_reset(slider_history_t *h);
+uint32_t slider_filter_apply(slider_history_t *h, slider_filter_cfg_t cfg, uint32_t scan, uint32_t now_us);
+
+// added latency, in scans of a same half
+uint8_t slider_filter_press_latency(slider_filter_cfg_t cfg);
+uint8_t slider_filter_release_latency(slider_filter_cfg_t cfg);
+
+#endif /* SLIDER_FILTER_H_ */
@@ -0,0 +1,437 @@
+/**
+ * Ipega Diva Plus host tests
+ *
+ * Cross core stress test, meant to run under ThreadSanitizer: the firmware's main() (core 0 slider decode)
+ * and core 1 loop run as threads of the threaded simulation with random preemption, a driver thread feeds
+ * random slider scans on the simulated i2c bus and random button presses and flips the mode switch (core 0
+ * then resets and relaunches core 1, possibly while it holds the latch spinlock), and the host thread polls
+ * the IN endpoints, reads the diagnostics and enumerates again after each detach. Checked on every report:
+ *  - the report bytes delivered are the ones handed to tud_hid_n_report() (not changed while in flight)
+ *  - the slider is one published frame, plus latched presses of the frames since the previous report
+ *    (no slider half from a frame and the other half from another)
+ *  - the slide contacts of the diagnostics all come from a same frame
+ *  - event reports are numbered without gaps and every input alternates between pressed and released
+ *    (reports still armed at a bus reset are lost, the event checks start over after it)
+ *
+ * usage: core_stress [duration_ms] (SIM_SEED picks the random schedule)
+ */
+#define main firmware_main
+#define tud_hid_n_report stress_hid_n_report
+#include "../main.c"
+#undef tud_hid_n_report
+#undef main
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "sim.h"
+#include "usb_mock.h"
+
+#define MAX_FRAMES     (1 << 20)
+#define MAX_SUBMITTED  256     // per HID instance, power of two
+#define HOST_POLL_US   1000
+#define DIAG_EVERY     20      // host polls between two diagnostics reads
+#define HALF_SCAN_US   300     // upper bound of the random pause between two half scans
+#define MODE_TOGGLE_MS 300     // the driver flips the mode switch this often
+
+bool tud_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len);
+
+typedef struct submitted_s {
+    uint8_t len;
+    uint8_t data[64];
+} submitted_t;
+
+static int s_failures = 0;
+static const char *s_variant = INPUT_EVENT_REPORT ? "stress_events" : "stress";
+
+// reports accepted by the USB stack, in order, per HID instance
+static pthread_mutex_t s_submitted_lock = PTHREAD_MUTEX_INITIALIZER;
+static submitted_t s_submitted[2][MAX_SUBMITTED];
+static uint32_t s_submitted_head[2];
+static uint32_t s_submitted_tail[2];
+
+// every slider value core 0 publishes, registered by the driver before it puts the scan on the bus
+static uint32_t s_frames[MAX_FRAMES];
+static _Atomic uint32_t s_frame_count;
+static _Atomic bool s_driver_stop;
+static _Atomic bool s_toggle_stop;
+static _Atomic uint32_t s_mode_toggles;
+
+static uint32_t s_reports;
+static uint32_t s_kb_reports;
+static uint32_t s_reconnects;
+static uint32_t s_event_reports;
+static uint32_t s_diags;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s: FAIL line %d: ", s_variant, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        s_failures++; \
+    } } while (0)
+
+static void sleep_real_us(uint32_t us)
+{
+    struct timespec ts = {0, (long)us * 1000};
+    nanosleep(&ts, NULL);
+}
+
+static uint32_t elapsed_ms(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+//--------------------------------------------------------------------+
+// Core 1 side, records what the firmware submits
+//--------------------------------------------------------------------+
+
+bool stress_hid_n_report(uint8_t instance, uint8_t report_id, void const *report, uint16_t len)
+{
+    // held across the call so the host cannot get the packet before it was recorded
+    pthread_mutex_lock(&s_submitted_lock);
+    bool ok = tud_hid_n_report(instance, report_id, report, len);
+    if (ok && instance < 2 && len <= sizeof(s_submitted[0][0].data))
+    {
+        submitted_t *s = &s_submitted[instance][s_submitted_head[instance]++ % MAX_SUBMITTED];
+        s->len = (uint8_t)len;
+        memcpy(s->data, report, len);
+    }
+    pthread_mutex_unlock(&s_submitted_lock);
+    return ok;
+}
+
+static bool pop_submitted(uint8_t instance, submitted_t *out)
+{
+    pthread_mutex_lock(&s_submitted_lock);
+    bool ok = s_submitted_tail[instance] != s_submitted_head[instance];
+    if (ok)
+        *out = s_submitted[instance][s_submitted_tail[instance]++ % MAX_SUBMITTED];
+    pthread_mutex_unlock(&s_submitted_lock);
+    return ok;
+}
+
+// bus reset, the reports still armed are dropped with it (atomic with the submissions)
+static void bus_reset()
+{
+    pthread_mutex_lock(&s_submitted_lock);
+    usb_host_bus_reset();
+    for (int i = 0; i < 2; i++)
+        s_submitted_tail[i] = s_submitted_head[i];
+    pthread_mutex_unlock(&s_submitted_lock);
+}
+
+//--------------------------------------------------------------------+
+// Driver: Ipega MCU and player
+//--------------------------------------------------------------------+
+
+static void push(uint32_t ev, uint8_t data)
+{
+    sim_i2c_push((ev << 10) | ((uint32_t)data << 1));
+}
+
+static void *driver_thread(void *arg)
+{
+    (void)arg;
+    uint32_t slider = 0;
+    uint8_t half = 1;
+    static const uint8_t pins[] = {PIN_TRIANGLE, PIN_SQUARE, PIN_CROSS, PIN_CIRCLE, PIN_L1, PIN_R1, PIN_UP, PIN_DOWN};
+    bool kb = false;
+    struct timespec toggle;
+    clock_gettime(CLOCK_MONOTONIC, &toggle);
+
+    while (!s_driver_stop)
+    {
+        // random half scan, each zone touched with a 1/4 probability (cells from the decode tables of main.c)
+        uint8_t data[10] = {0};
+        uint32_t scan = 0;
+        uint32_t mask = 0;
+        uint8_t offset = (half == 1) ? 0 : 8;
+        for (int idx = 1; idx <= 9; idx++)
+        {
+            uint32_t r = sim_rand();
+            data[idx] = ((r & 3) ? 0 : 0x0F) | ((r & 0xC) ? 0 : 0xF0);
+            switch (idx)
+            {
+                case 1: case 4: case 7:
+                    mask |= s_tab0f[idx + offset];
+                    if (data[idx] & 0x0f)
+                        scan |= s_tab0f[idx + offset];
+                    /* fallthrough */
+                case 2: case 5: case 8:
+                    mask |= s_tabf0[idx + offset];
+                    if (data[idx] & 0xf0)
+                        scan |= s_tabf0[idx + offset];
+                default:
+                    break;
+            }
+        }
+        slider = (slider & ~mask) | (scan & mask);
+
+        uint32_t k = s_frame_count;
+        if (k + 1 >= MAX_FRAMES)
+            break;
+        s_frames[k + 1] = slider;
+        s_frame_count = k + 1;
+
+        push(EV_START, 0);
+        push(EV_DATA, 0x58);
+        push(EV_DATA, half);
+        push(EV_STOP, 0);
+        push(EV_START, 0);
+        push(EV_DATA, 0x59);
+        for (int idx = 1; idx <= 9; idx++)
+            push(EV_DATA, data[idx]);
+        push(EV_STOP, 0);
+        half = (half == 1) ? 2 : 1;
+
+        uint32_t r = sim_rand();
+        if ((r & 7) == 0)
+        {
+            uint8_t pin = pins[(r >> 3) % count_of(pins)];
+            sim_set_pressed(pin, (r >> 8) & 1);
+        }
+        if (!s_toggle_stop && elapsed_ms(&toggle) >= MODE_TOGGLE_MS)
+        {
+            clock_gettime(CLOCK_MONOTONIC, &toggle);
+            kb = !kb;
+            sim_set_level(PIN_MODESWITCH, kb);
+            s_mode_toggles++;
+        }
+        sleep_real_us((r >> 16) % HALF_SCAN_US);
+    }
+    return NULL;
+}
+
+//--------------------------------------------------------------------+
+// Host side checks
+//--------------------------------------------------------------------+
+
+static void pump()
+{
+    sleep_real_us(20);
+}
+
+static int control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, uint16_t length, void *data)
+{
+    tusb_control_request_t req = {.bmRequestType = type, .bRequest = request, .wValue = value,
+                                  .wIndex = index, .wLength = length};
+    return usb_host_control(&req, data, pump);
+}
+
+// run centers like slide_tracker.c, in 1/256 cell
+static int frame_runs(uint32_t slider, uint16_t *center)
+{
+    int count = 0;
+    int start = -1;
+    for (int cell = 0; cell <= 32; cell++)
+    {
+        bool set = (cell < 32) && ((slider >> (31 - cell)) & 1);
+        if (set && start < 0)
+            start = cell;
+        else if (!set && start >= 0)
+        {
+            center[count++] = (start + cell - 1) * 128;
+            start = -1;
+        }
+    }
+    return count;
+}
+
+static uint32_t s_report_frame = 0; // oldest frame the next report can come from
+
+static void check_report(const uint8_t *data, int len)
+{
+    submitted_t sub;
+    CHECK(pop_submitted(0, &sub), "report delivered but never submitted");
+    CHECK(sub.len == len && !memcmp(sub.data, data, len), "report %u changed in flight", s_reports);
+    s_reports++;
+    if (len != sizeof(joy_report_t))
+    {
+        s_kb_reports++; // keyboard mode, the slider is spread over keys
+        return;
+    }
+
+    // LX LY RX RY carry the slider, xored with the stick center
+    uint32_t slider = (data[3] | (data[4] << 8) | (data[5] << 16) | ((uint32_t)data[6] << 24)) ^ 0x80808080;
+    uint32_t count = s_frame_count;
+    uint32_t seen = 0; // frames since the oldest candidate, for the latched presses
+    for (uint32_t k = s_report_frame; k <= count; k++)
+    {
+        seen |= s_frames[k];
+        if ((s_frames[k] & ~slider) == 0 && (slider & ~(s_frames[k] | seen)) == 0)
+        {
+            s_report_frame = k;
+            return;
+        }
+    }
+    CHECK(false, "report %u slider %08x is not a published frame (frames %u..%u)", s_reports, slider, s_report_frame, count);
+}
+
+#if INPUT_EVENT_REPORT
+static uint8_t s_event_seq;
+static uint8_t s_input_state[72];
+static bool s_input_known[72];
+static bool s_event_resync = false; // first event report since a reconnect
+
+static void check_event_report(const uint8_t *data, int len)
+{
+    submitted_t sub;
+    CHECK(pop_submitted(1, &sub), "event report delivered but never submitted");
+    CHECK(sub.len == len && !memcmp(sub.data, data, len), "event report %u changed in flight", s_event_reports);
+    if (len != sizeof(event_report_t))
+        return;
+
+    event_report_t ev;
+    memcpy(&ev, data, sizeof(ev));
+    CHECK(!s_event_reports || s_event_resync || ev.seq == (uint8_t)(s_event_seq + 1), "event report seq %u after %u", ev.seq, s_event_seq);
+    s_event_resync = false;
+    s_event_seq = ev.seq;
+    s_event_reports++;
+
+    // with nothing dropped every input alternates, slide contacts only have a slot in range
+    for (int i = 0; i < ev.count && i < EVENT_REPORT_EVENTS; i++)
+    {
+        uint8_t id = ev.events[i].id;
+        uint8_t state = ev.events[i].state;
+        CHECK(id < 72, "event id %u", id);
+        if (INPUT_ID_IS_SLIDE(id) || ev.dropped || id >= 72)
+            continue;
+        CHECK(!s_input_known[id] || state == !s_input_state[id], "input %u state %u twice in a row", id, state);
+        s_input_state[id] = state;
+        s_input_known[id] = true;
+    }
+}
+#endif
+
+static uint32_t s_diag_frame = 0;
+
+static diag_report_t check_diag()
+{
+    diag_report_t diag = {0};
+    uint32_t disconnects = usb_mock_stats().disconnects;
+    int len = control(0xA1, HID_REQ_CONTROL_GET_REPORT, (HID_REPORT_TYPE_FEATURE << 8) | 0, 0, 64, &diag);
+    if (usb_mock_stats().disconnects != disconnects)
+        return diag; // detached during the transfer
+    CHECK(len == sizeof(diag), "diagnostics length %d", len);
+    s_diags++;
+
+    // contact count and positions from one frame (the tracker follows at most SLIDE_MAX_CONTACTS runs)
+    uint32_t count = s_frame_count;
+    for (uint32_t k = s_diag_frame; k <= count; k++)
+    {
+        uint16_t center[16];
+        int runs = frame_runs(s_frames[k], center);
+        if (diag.slide_contacts != ((runs < SLIDE_MAX_CONTACTS) ? runs : SLIDE_MAX_CONTACTS))
+            continue;
+        bool found = true;
+        for (int i = 0; i < diag.slide_contacts && i < SLIDE_REPORT_CONTACTS; i++)
+        {
+            bool center_found = false;
+            for (int r = 0; r < runs; r++)
+                center_found |= diag.slide[i].position == center[r];
+            found &= center_found;
+        }
+        if (found)
+        {
+            s_diag_frame = k;
+            return diag;
+        }
+    }
+    CHECK(false, "slide contacts %u at %u/%u are not from one frame (frames %u..%u)", diag.slide_contacts,
+          diag.slide[0].position, diag.slide[1].position, s_diag_frame, count);
+    return diag;
+}
+
+// enumeration checks do not apply when the device detached again in the middle
+#define ENUM_CHECK(cond, ...) CHECK((cond) || usb_mock_stats().disconnects != disconnects, __VA_ARGS__)
+
+static void enumerate()
+{
+    uint8_t buf[64];
+    while (!usb_device_connected())
+        sleep_real_us(100);
+    uint32_t disconnects = usb_mock_stats().disconnects;
+    bus_reset();
+#if INPUT_EVENT_REPORT
+    s_event_resync = true;
+    memset(s_input_known, 0, sizeof(s_input_known)); // events of the dropped reports are lost
+#endif
+    ENUM_CHECK(control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_DEVICE << 8, 0, 18, buf) == 18, "device descriptor");
+    ENUM_CHECK(control(0x00, TUSB_REQ_SET_ADDRESS, 5, 0, 0, NULL) == 0, "SET_ADDRESS");
+    ENUM_CHECK(control(0x00, TUSB_REQ_SET_CONFIGURATION, 1, 0, 0, NULL) == 0, "SET_CONFIGURATION");
+    for (int itf = 0; itf < CFG_TUD_HID; itf++)
+        ENUM_CHECK(control(0x21, HID_REQ_CONTROL_SET_IDLE, 0, itf, 0, NULL) == 0, "SET_IDLE %d", itf);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t duration_ms = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000;
+
+    sim_init(true);
+    sim_set_level(PIN_MODESWITCH, false); // gamepad mode
+    sim_run_core0(firmware_main);
+
+    pthread_t driver;
+    pthread_create(&driver, NULL, driver_thread, NULL);
+
+    enumerate();
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t disconnects = 0;
+    for (uint32_t poll = 0;; poll++)
+    {
+        uint8_t buf[64];
+        if (usb_mock_stats().disconnects != disconnects)
+        {
+            // mode switch: core 0 detached the device, wait for the attach and enumerate again
+            disconnects = usb_mock_stats().disconnects;
+            enumerate();
+            s_reconnects++;
+            continue;
+        }
+        int len = usb_host_in(0x81, buf, sizeof(buf));
+        if (len >= 0)
+            check_report(buf, len);
+#if INPUT_EVENT_REPORT
+        len = usb_host_in(0x82, buf, sizeof(buf));
+        if (len >= 0)
+            check_event_report(buf, len);
+#endif
+        if (poll % DIAG_EVERY == DIAG_EVERY - 1)
+            check_diag();
+
+        sleep_real_us(HOST_POLL_US);
+        if (elapsed_ms(&start) >= duration_ms && !s_toggle_stop)
+        {
+            // no more mode changes, run until the last one is through
+            s_toggle_stop = true;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            duration_ms = (MODE_CHECK_INTERVAL_US / 1000) + RECONNECT_DELAY_MS + 100;
+        }
+        else if (s_toggle_stop && elapsed_ms(&start) >= duration_ms && usb_mock_stats().disconnects == disconnects)
+            break;
+    }
+
+    diag_report_t diag = check_diag();
+    CHECK(diag.sniffer_restarts == 0, "%u sniffer restarts, the driver fell behind", diag.sniffer_restarts);
+
+    s_driver_stop = true;
+    pthread_join(driver, NULL);
+    sim_stop_cores();
+
+    usb_mock_stats_t stats = usb_mock_stats();
+    CHECK(!stats.rearmed_busy, "%u endpoints re-armed while busy", stats.rearmed_busy);
+    CHECK(s_reports > s_kb_reports && s_kb_reports > 0, "%u reports, %u in keyboard mode", s_reports, s_kb_reports);
+    CHECK(s_reconnects == stats.disconnects && s_reconnects == s_mode_toggles && s_reconnects > 0,
+          "%u reconnects for %u detaches, %u mode changes", s_reconnects, stats.disconnects, (uint32_t)s_mode_toggles);
+    printf("%s: %u frames, %u reports (%u keyboard), %u event reports, %u diagnostics, %u mode changes\n", s_variant,
+           (uint32_t)s_frame_count, s_reports, s_kb_reports, s_event_reports, s_diags, s_reconnects);
+    printf("%s: %s\n", s_variant, s_failures ? "FAILED" : "passed");
+    return s_failures ? 1 : 0;
+}
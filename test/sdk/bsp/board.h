@@ -0,0 +1,9 @@
+#ifndef SIM_BSP_BOARD_H_
+#define SIM_BSP_BOARD_H_
+
+#include "tusb.h"
+
+void board_init(void);
+uint32_t board_millis(void);
+
+#endif
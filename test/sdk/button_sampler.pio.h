@@ -0,0 +1,16 @@
+#ifndef SIM_BUTTON_SAMPLER_PIO_H_
+#define SIM_BUTTON_SAMPLER_PIO_H_
+
+/* Host stand-in for the header pioasm generates from button_sampler.pio, samples are written by test/sim.c */
+
+#include "hardware/pio.h"
+
+#define BUTTON_BASE_PIN      4
+#define BUTTON_PIN_COUNT     25
+#define BUTTON_SAMPLE_CYCLES 8
+
+extern const pio_program_t button_sampler_program;
+
+void button_sampler_program_init(PIO pio, uint sm, uint offset, float div);
+
+#endif
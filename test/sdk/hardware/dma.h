@@ -0,0 +1,44 @@
+#ifndef SIM_HARDWARE_DMA_H_
+#define SIM_HARDWARE_DMA_H_
+
+#include "pico/stdlib.h"
+
+#define NUM_DMA_CHANNELS 12
+
+// write_addr is updated by the simulated DMA, hence atomic
+typedef struct {
+    uintptr_t read_addr;
+    _Atomic uintptr_t write_addr;
+} dma_channel_hw_t;
+
+typedef struct {
+    dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+} dma_hw_t;
+
+extern dma_hw_t *dma_hw;
+
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+
+typedef struct {
+    uint8_t  size;
+    bool     read_increment;
+    bool     write_increment;
+    bool     ring_write;
+    uint8_t  ring_bits;
+    int      dreq;
+    int      chain_to;
+} dma_channel_config;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_start(uint channel);
+
+#endif
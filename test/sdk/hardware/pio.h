@@ -0,0 +1,36 @@
+#ifndef SIM_HARDWARE_PIO_H_
+#define SIM_HARDWARE_PIO_H_
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    volatile uint32_t txf[4];
+    volatile uint32_t rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t *pio0;
+extern pio_hw_t *pio1;
+
+typedef struct {
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+uint pio_claim_unused_sm(PIO pio, bool required);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled);
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_interrupt_clear(PIO pio, uint irq);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+uint pio_encode_jmp(uint addr);
+
+#endif
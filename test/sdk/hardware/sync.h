@@ -0,0 +1,15 @@
+#ifndef SIM_HARDWARE_SYNC_H_
+#define SIM_HARDWARE_SYNC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef volatile uint32_t spin_lock_t;
+
+int spin_lock_claim_unused(bool required);
+spin_lock_t *spin_lock_init(uint32_t lock_num);
+uint32_t spin_lock_blocking(spin_lock_t *lock);
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq);
+void spin_unlock_unsafe(spin_lock_t *lock);
+
+#endif
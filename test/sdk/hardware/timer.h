@@ -0,0 +1,13 @@
+#ifndef SIM_HARDWARE_TIMER_H_
+#define SIM_HARDWARE_TIMER_H_
+
+#include "pico/stdlib.h"
+
+typedef struct {
+    volatile uint32_t timerawh;
+    volatile uint32_t timerawl;
+} timer_hw_t;
+
+extern timer_hw_t *timer_hw;
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SIM_HARDWARE_WATCHDOG_H_
+#define SIM_HARDWARE_WATCHDOG_H_
+
+#include "pico/stdlib.h"
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update(void);
+bool watchdog_caused_reboot(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SIM_I2C_SNIFFER_PIO_H_
+#define SIM_I2C_SNIFFER_PIO_H_
+
+/* Host stand-in for the header pioasm generates from i2c_sniffer.pio, the sniffer words are fed with sim_i2c_push() */
+
+#include "hardware/pio.h"
+
+#define SDA_PIN   0
+#define EV0_PIN   1
+#define EV1_PIN   2
+#define SCL_PIN   3
+#define IRQ_EVENT 7
+#define EV_DATA   0x00
+#define EV_START  0x01
+#define EV_STOP   0x03
+
+extern const pio_program_t i2c_main_program;
+extern const pio_program_t i2c_data_program;
+extern const pio_program_t i2c_start_program;
+extern const pio_program_t i2c_stop_program;
+
+void i2c_main_program_init(PIO pio, uint sm, uint offset, float div);
+void i2c_data_program_init(PIO pio, uint sm, uint offset, float div);
+void i2c_start_program_init(PIO pio, uint sm, uint offset, float div);
+void i2c_stop_program_init(PIO pio, uint sm, uint offset, float div);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SIM_PICO_BOOTROM_H_
+#define SIM_PICO_BOOTROM_H_
+
+#include "pico/stdlib.h"
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef SIM_PICO_MULTICORE_H_
+#define SIM_PICO_MULTICORE_H_
+
+#include "pico/stdlib.h"
+
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SIM_PICO_STDLIB_H_
+#define SIM_PICO_STDLIB_H_
+
+/* Host stand-in for the parts of the Pico SDK used by the firmware, backed by test/sim.c */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef unsigned int uint;
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define __dmb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define GPIO_IN  false
+#define GPIO_OUT true
+
+void stdio_init_all(void);
+bool set_sys_clock_khz(uint32_t freq_khz, bool required);
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_pull_up(uint gpio);
+bool gpio_get(uint gpio);
+uint32_t gpio_get_all(void);
+
+uint64_t time_us_64(void);
+uint32_t time_us_32(void);
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+
+#include "hardware/sync.h"
+
+#endif
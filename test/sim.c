@@ -0,0 +1,513 @@
+/**
+ * Ipega Diva Plus host tests
+ *
+ * Simulated RP2040, implements the Pico SDK subset declared in test/sdk
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "pico/bootrom.h"
+#include "bsp/board.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+#include "hardware/clocks.h"
+#include "hardware/watchdog.h"
+#include "i2c_sniffer.pio.h"
+#include "button_sampler.pio.h"
+
+#include "sim.h"
+
+#define SAMPLE_PERIOD_US 10     // BUTTON_SAMPLE_HZ
+#define I2C_FIFO_SIZE    4096   // power of two, much deeper than the real one so the feeder can run ahead
+
+static bool s_threaded;
+static uint64_t s_virtual_us;
+static struct timespec s_start;
+
+static _Atomic uint32_t s_gpio = 0xFFFFFFFF; // everything pulled up
+
+static pio_hw_t s_pio[2];
+pio_hw_t *pio0 = &s_pio[0];
+pio_hw_t *pio1 = &s_pio[1];
+static uint s_pio_sm_claimed[2];
+static _Atomic bool s_sampler_enabled;
+
+static uint32_t s_i2c_fifo[I2C_FIFO_SIZE];
+static _Atomic uint32_t s_i2c_head;
+static _Atomic uint32_t s_i2c_tail;
+
+static dma_hw_t s_dma_hw;
+dma_hw_t *dma_hw = &s_dma_hw;
+static dma_channel_config s_dma_cfg[NUM_DMA_CHANNELS];
+static uintptr_t s_dma_base[NUM_DMA_CHANNELS];
+static int s_dma_claimed;
+static _Atomic int s_dma_sample = -1; // paced channel started by dma_channel_start(), after the configuration
+static uint32_t s_sampler_y;  // last pushed sample (the state machine Y register)
+
+static timer_hw_t s_timer_hw;
+timer_hw_t *timer_hw = &s_timer_hw;
+
+static spin_lock_t s_spin_locks[32];
+static int s_spin_claimed;
+
+// threaded mode
+static pthread_t s_core_thread[2];
+static bool s_core_running[2];
+static _Atomic bool s_core_stop[2];
+static pthread_t s_hw_thread;
+static _Atomic bool s_hw_stop;
+static _Thread_local int s_role = -1; // 0/1 on the core threads
+static _Thread_local uint32_t s_rand_state;
+static _Thread_local bool s_rand_seeded;
+
+const pio_program_t i2c_main_program = {0};
+const pio_program_t i2c_data_program = {0};
+const pio_program_t i2c_start_program = {0};
+const pio_program_t i2c_stop_program = {0};
+const pio_program_t button_sampler_program = {0};
+
+static void sample_buttons(uint32_t now);
+static uint64_t now_us(void);
+
+//--------------------------------------------------------------------+
+// Simulation control
+//--------------------------------------------------------------------+
+
+uint32_t sim_rand(void)
+{
+    if (!s_rand_seeded)
+    {
+        const char *seed = getenv("SIM_SEED");
+        s_rand_state = (seed ? strtoul(seed, NULL, 0) : 1) * 2654435761u + (uint32_t)(s_role + 2) * 40503u;
+        s_rand_seeded = true;
+    }
+    // xorshift32
+    uint32_t x = s_rand_state ? s_rand_state : 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    s_rand_state = x;
+    return x;
+}
+
+void sim_preempt(void)
+{
+    if (!s_threaded)
+        return;
+
+    uint32_t r = sim_rand();
+    if ((r & 0xFF) == 0)
+    {
+        struct timespec ts = {0, (long)((r >> 8) % 50) * 1000};
+        nanosleep(&ts, NULL);
+    }
+    else if ((r & 0x0F) == 0)
+        sched_yield();
+}
+
+static void *hw_thread(void *arg)
+{
+    (void)arg;
+    while (!s_hw_stop)
+    {
+        sample_buttons((uint32_t)now_us());
+        struct timespec ts = {0, SAMPLE_PERIOD_US * 1000};
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+void sim_init(bool threaded)
+{
+    s_threaded = threaded;
+    clock_gettime(CLOCK_MONOTONIC, &s_start);
+    if (threaded)
+        pthread_create(&s_hw_thread, NULL, hw_thread, NULL);
+}
+
+bool sim_threaded(void)
+{
+    return s_threaded;
+}
+
+void sim_advance_us(uint64_t us)
+{
+    uint64_t end = s_virtual_us + us;
+    uint64_t tick = (s_virtual_us / SAMPLE_PERIOD_US + 1) * SAMPLE_PERIOD_US;
+    for (; tick <= end; tick += SAMPLE_PERIOD_US)
+    {
+        s_virtual_us = tick;
+        sample_buttons((uint32_t)tick);
+    }
+    s_virtual_us = end;
+}
+
+void sim_set_level(unsigned gpio, bool level)
+{
+    if (level)
+        s_gpio |= 1u << gpio;
+    else
+        s_gpio &= ~(1u << gpio);
+}
+
+void sim_set_pressed(unsigned gpio, bool pressed)
+{
+    sim_set_level(gpio, !pressed);
+}
+
+void sim_i2c_push(uint32_t word)
+{
+    while (s_i2c_head - s_i2c_tail >= I2C_FIFO_SIZE)
+        sched_yield();
+    uint32_t head = s_i2c_head;
+    s_i2c_fifo[head % I2C_FIFO_SIZE] = word;
+    s_i2c_head = head + 1;
+}
+
+bool sim_i2c_idle(void)
+{
+    return s_i2c_head == s_i2c_tail;
+}
+
+// stop point of the core threads
+static void core_checkpoint(void)
+{
+    if (s_role >= 0 && s_core_stop[s_role])
+        pthread_exit(NULL);
+}
+
+static void *core1_thread(void *arg)
+{
+    s_role = 1;
+    ((void (*)(void))arg)();
+    return NULL;
+}
+
+static void *core0_thread(void *arg)
+{
+    s_role = 0;
+    ((int (*)(void))arg)();
+    return NULL;
+}
+
+void sim_run_core0(int (*entry)(void))
+{
+    s_core_stop[0] = false;
+    s_core_running[0] = true;
+    pthread_create(&s_core_thread[0], NULL, core0_thread, (void *)entry);
+}
+
+void sim_stop_cores(void)
+{
+    if (s_core_running[0])
+    {
+        s_core_stop[0] = true;
+        pthread_join(s_core_thread[0], NULL);
+        s_core_running[0] = false;
+    }
+    multicore_reset_core1();
+    if (s_threaded)
+    {
+        s_hw_stop = true;
+        pthread_join(s_hw_thread, NULL);
+    }
+}
+
+//--------------------------------------------------------------------+
+// pico/stdlib, clocks, watchdog, bootrom, board
+//--------------------------------------------------------------------+
+
+void stdio_init_all(void) {}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+    (void)freq_khz;
+    (void)required;
+    return true;
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+    (void)clk_index;
+    return 200000000;
+}
+
+void gpio_init(uint gpio) { (void)gpio; }
+void gpio_set_dir(uint gpio, bool out) { (void)gpio; (void)out; }
+void gpio_pull_up(uint gpio) { (void)gpio; }
+
+bool gpio_get(uint gpio)
+{
+    sim_preempt();
+    return (s_gpio >> gpio) & 1;
+}
+
+uint32_t gpio_get_all(void)
+{
+    sim_preempt();
+    return s_gpio;
+}
+
+static uint64_t now_us(void)
+{
+    if (!s_threaded)
+        return s_virtual_us;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - s_start.tv_sec) * 1000000 + (ts.tv_nsec - s_start.tv_nsec) / 1000;
+}
+
+// only called at the top of the core 1 loop, a safe place to stop the thread
+uint64_t time_us_64(void)
+{
+    sim_preempt();
+    core_checkpoint();
+    return now_us();
+}
+
+uint32_t time_us_32(void)
+{
+    sim_preempt();
+    return (uint32_t)now_us();
+}
+
+void sleep_us(uint64_t us)
+{
+    if (!s_threaded)
+    {
+        sim_advance_us(us);
+        return;
+    }
+    struct timespec ts = {(time_t)(us / 1000000), (long)(us % 1000000) * 1000};
+    nanosleep(&ts, NULL);
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t)ms * 1000);
+}
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug) { (void)delay_ms; (void)pause_on_debug; }
+void watchdog_update(void) {}
+bool watchdog_caused_reboot(void) { return false; }
+
+void reset_usb_boot(uint32_t usb_activity_gpio_pin_mask, uint32_t disable_interface_mask)
+{
+    (void)usb_activity_gpio_pin_mask;
+    (void)disable_interface_mask;
+    fprintf(stderr, "reset_usb_boot() called\n");
+    abort();
+}
+
+void board_init(void) {}
+
+uint32_t board_millis(void)
+{
+    return (uint32_t)(now_us() / 1000);
+}
+
+//--------------------------------------------------------------------+
+// Spinlocks, multicore
+//--------------------------------------------------------------------+
+
+int spin_lock_claim_unused(bool required)
+{
+    (void)required;
+    return s_spin_claimed++;
+}
+
+spin_lock_t *spin_lock_init(uint32_t lock_num)
+{
+    s_spin_locks[lock_num] = 0;
+    return &s_spin_locks[lock_num];
+}
+
+// a core can be stopped (multicore_reset_core1()) while it holds the lock
+uint32_t spin_lock_blocking(spin_lock_t *lock)
+{
+    sim_preempt();
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+    {
+        core_checkpoint();
+        sched_yield();
+    }
+    sim_preempt();
+    core_checkpoint();
+    return 0;
+}
+
+void spin_unlock(spin_lock_t *lock, uint32_t saved_irq)
+{
+    (void)saved_irq;
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void spin_unlock_unsafe(spin_lock_t *lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+    if (!s_threaded)
+    {
+        fprintf(stderr, "multicore_launch_core1() needs the threaded simulation\n");
+        abort();
+    }
+    s_core_stop[1] = false;
+    s_core_running[1] = true;
+    pthread_create(&s_core_thread[1], NULL, core1_thread, (void *)entry);
+}
+
+void multicore_reset_core1(void)
+{
+    if (!s_core_running[1])
+        return;
+    s_core_stop[1] = true;
+    pthread_join(s_core_thread[1], NULL);
+    s_core_running[1] = false;
+}
+
+//--------------------------------------------------------------------+
+// PIO
+//--------------------------------------------------------------------+
+
+uint pio_claim_unused_sm(PIO pio, bool required)
+{
+    (void)required;
+    return s_pio_sm_claimed[pio == pio1]++;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+    (void)pio;
+    (void)program;
+    return 0;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    (void)sm;
+    if (pio == pio1)
+        s_sampler_enabled = enabled;
+}
+
+void pio_set_sm_mask_enabled(PIO pio, uint32_t mask, bool enabled) { (void)pio; (void)mask; (void)enabled; }
+void pio_enable_sm_mask_in_sync(PIO pio, uint32_t mask) { (void)pio; (void)mask; }
+void pio_sm_restart(PIO pio, uint sm) { (void)pio; (void)sm; }
+void pio_sm_exec(PIO pio, uint sm, uint instr) { (void)pio; (void)sm; (void)instr; }
+void pio_interrupt_clear(PIO pio, uint irq) { (void)pio; (void)irq; }
+uint pio_encode_jmp(uint addr) { return addr; }
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return (pio == pio1 ? 8 : 0) + sm + (is_tx ? 0 : 4);
+}
+
+// only the sniffer main state machine (first one claimed on pio0) ever has data
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm)
+{
+    sim_preempt();
+    core_checkpoint();
+    return pio != pio0 || sm != 0 || s_i2c_head == s_i2c_tail;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm)
+{
+    (void)pio;
+    (void)sm;
+    uint32_t tail = s_i2c_tail;
+    uint32_t word = s_i2c_fifo[tail % I2C_FIFO_SIZE];
+    s_i2c_tail = tail + 1;
+    return word;
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+    (void)sm;
+    if (pio == pio0)
+        s_i2c_tail = (uint32_t)s_i2c_head;
+}
+
+void i2c_main_program_init(PIO pio, uint sm, uint offset, float div) { (void)pio; (void)sm; (void)offset; (void)div; }
+void i2c_data_program_init(PIO pio, uint sm, uint offset, float div) { (void)pio; (void)sm; (void)offset; (void)div; }
+void i2c_start_program_init(PIO pio, uint sm, uint offset, float div) { (void)pio; (void)sm; (void)offset; (void)div; }
+void i2c_stop_program_init(PIO pio, uint sm, uint offset, float div) { (void)pio; (void)sm; (void)offset; (void)div; }
+void button_sampler_program_init(PIO pio, uint sm, uint offset, float div) { (void)pio; (void)sm; (void)offset; (void)div; }
+
+//--------------------------------------------------------------------+
+// DMA, the button sampler pushes through the sample channel then its chained timestamp channel
+//--------------------------------------------------------------------+
+
+int dma_claim_unused_channel(bool required)
+{
+    (void)required;
+    return s_dma_claimed++;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    dma_channel_config c = {.size = DMA_SIZE_32, .read_increment = true, .write_increment = false,
+                            .dreq = -1, .chain_to = (int)channel};
+    return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size) { c->size = size; }
+void channel_config_set_read_increment(dma_channel_config *c, bool incr) { c->read_increment = incr; }
+void channel_config_set_write_increment(dma_channel_config *c, bool incr) { c->write_increment = incr; }
+void channel_config_set_dreq(dma_channel_config *c, uint dreq) { c->dreq = (int)dreq; }
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to) { c->chain_to = (int)chain_to; }
+
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+    c->ring_write = write;
+    c->ring_bits = (uint8_t)size_bits;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+                           const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    (void)transfer_count;
+    s_dma_cfg[channel] = *config;
+    s_dma_base[channel] = (uintptr_t)write_addr;
+    s_dma_hw.ch[channel].read_addr = (uintptr_t)read_addr;
+    s_dma_hw.ch[channel].write_addr = (uintptr_t)write_addr;
+    if (trigger)
+        dma_channel_start(channel);
+}
+
+void dma_channel_start(uint channel)
+{
+    s_dma_sample = (int)channel;
+}
+
+static void dma_write(int channel, uint32_t value)
+{
+    dma_channel_config *c = &s_dma_cfg[channel];
+    uintptr_t addr = s_dma_hw.ch[channel].write_addr;
+    *(uint32_t *)addr = value;
+    uintptr_t ring = (uintptr_t)1 << c->ring_bits;
+    uintptr_t next = s_dma_base[channel] + ((addr - s_dma_base[channel] + sizeof(uint32_t)) & (ring - 1));
+    __atomic_store_n(&s_dma_hw.ch[channel].write_addr, next, __ATOMIC_RELEASE);
+}
+
+static void sample_buttons(uint32_t now)
+{
+    if (!s_sampler_enabled || s_dma_sample < 0)
+        return;
+
+    uint32_t bank = (s_gpio >> BUTTON_BASE_PIN) & ((1u << BUTTON_PIN_COUNT) - 1);
+    if (bank == s_sampler_y)
+        return;
+    s_sampler_y = bank;
+    dma_write(s_dma_sample, bank);
+    dma_write(s_dma_cfg[s_dma_sample].chain_to, now);
+}
@@ -0,0 +1,35 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+/* Simulated RP2040 for the host tests: time, GPIO bank, PIO RX FIFOs, the button sampler DMA,
+ * spinlocks and the two cores.
+ *
+ * Virtual mode: time only moves with sim_advance_us(), single threaded, fully deterministic.
+ * Threaded mode: time is the host monotonic clock, each core is a thread and the shims randomly
+ * yield or sleep (seeded by SIM_SEED) to shake out races under ThreadSanitizer.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+void sim_init(bool threaded);
+bool sim_threaded(void);
+
+// virtual mode: move time forward, sampling the buttons every 10us like the PIO/DMA pair does
+void sim_advance_us(uint64_t us);
+
+// press (drive low) or release a button GPIO, level of any other input pin
+void sim_set_pressed(unsigned gpio, bool pressed);
+void sim_set_level(unsigned gpio, bool level);
+
+// feed one i2c sniffer word to the pio0 state machine the firmware reads (waits while the FIFO is full)
+void sim_i2c_push(uint32_t word);
+bool sim_i2c_idle(void);
+
+// threaded mode: random yield/sleep at shim points, stop the core threads
+void sim_preempt(void);
+void sim_run_core0(int (*entry)(void));
+void sim_stop_cores(void);
+uint32_t sim_rand(void);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,157 @@
+/**
+ * Ipega Diva Plus host tests
+ *
+ * Slide tracker on scripted slider sequences of Ipega pair zones: a finger resting on a zone border or
+ * widening must not slide, a real slide gets one event per zone
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "slide_tracker.h"
+
+#define SCAN_US 1000
+
+static int s_failures = 0;
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "slide: FAIL line %d: ", __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        s_failures++; \
+    } } while (0)
+
+typedef struct counts_s {
+    int started;
+    int continued;
+    int ended;
+    int last_cell;
+    int last_left;
+} counts_t;
+
+// Ipega pair zones first..last touched (zone k is cells 2+2k and 3+2k, cell 0 is bit 31)
+static uint32_t zones(int first, int last)
+{
+    uint32_t slider = 0;
+    for (int cell = 2 + 2 * first; cell <= 3 + 2 * last; cell++)
+        slider |= 1u << (31 - cell);
+    return slider;
+}
+
+static void feed(slide_tracker_t *t, uint32_t *now, uint32_t slider, counts_t *counts)
+{
+    slide_event_t events[SLIDE_MAX_CONTACTS * 2];
+    *now += SCAN_US;
+    int count = slide_tracker_update(t, slider, *now, events, SLIDE_MAX_CONTACTS * 2);
+    for (int i = 0; i < count; i++)
+    {
+        switch (SLIDE_STATE_TYPE(events[i].state))
+        {
+            case SLIDE_STARTED:   counts->started++; break;
+            case SLIDE_CONTINUED: counts->continued++; break;
+            case SLIDE_ENDED:     counts->ended++; break;
+        }
+        counts->last_cell = SLIDE_STATE_CELL(events[i].state);
+        counts->last_left = SLIDE_STATE_LEFT(events[i].state);
+    }
+}
+
+static void test_border_rest()
+{
+    slide_tracker_t t = {0};
+    counts_t counts = {0};
+    uint32_t now = 0;
+    // contact on the 4/5 zone border: mostly both zones, single scans on one or the other
+    const uint32_t flicker[] = {zones(4, 4), zones(4, 5), zones(5, 5), zones(4, 5), zones(4, 5), zones(5, 5),
+                                zones(4, 4), zones(5, 5), zones(4, 5), zones(4, 4), zones(4, 5), zones(4, 5)};
+    for (int i = 0; i < 300; i++)
+        feed(&t, &now, flicker[i % 12], &counts);
+    feed(&t, &now, 0, &counts);
+    CHECK(!counts.started && !counts.continued && !counts.ended, "border rest: %d started %d continued %d ended",
+          counts.started, counts.continued, counts.ended);
+}
+
+static void test_widening()
+{
+    slide_tracker_t t = {0};
+    counts_t counts = {0};
+    uint32_t now = 0;
+    for (int last = 3; last <= 4; last++)
+        for (int i = 0; i < 5; i++)
+            feed(&t, &now, zones(3, last), &counts);
+    for (int last = 4; last >= 3; last--)
+        for (int i = 0; i < 5; i++)
+            feed(&t, &now, zones(3, last), &counts);
+    feed(&t, &now, 0, &counts);
+    CHECK(!counts.started && !counts.continued && !counts.ended, "widening: %d started %d continued %d ended",
+          counts.started, counts.continued, counts.ended);
+}
+
+static void test_slide()
+{
+    slide_tracker_t t = {0};
+    counts_t counts = {0};
+    uint32_t now = 0;
+
+    // (2,3) -> (4,5) -> ... -> (14,15), two scans per zone and one on both in between:
+    // started on the first zone change, then one event per zone
+    for (int zone = 0; zone <= 6; zone++)
+    {
+        if (zone > 0)
+            feed(&t, &now, zones(zone - 1, zone), &counts);
+        feed(&t, &now, zones(zone, zone), &counts);
+        feed(&t, &now, zones(zone, zone), &counts);
+        CHECK(counts.started == (zone > 0) && counts.continued == (zone > 1 ? zone - 1 : 0),
+              "slide right zone %d: %d started %d continued", zone, counts.started, counts.continued);
+    }
+    CHECK(counts.last_cell == 15 && !counts.last_left, "slide right: last cell %d left %d", counts.last_cell, counts.last_left);
+
+    // coming to rest on the 6/7 border, no further event until it stops
+    const uint32_t flicker[] = {zones(6, 7), zones(7, 7), zones(6, 7), zones(6, 6)};
+    for (int i = 0; i < 40; i++)
+        feed(&t, &now, flicker[i % 4], &counts);
+    CHECK(counts.continued == 5, "rest after slide: %d continued", counts.continued);
+    for (int i = 0; i < SLIDE_STILL_US / SCAN_US; i++)
+        feed(&t, &now, zones(6, 6), &counts);
+    CHECK(counts.ended == 1, "rest after slide: %d ended", counts.ended);
+
+    // back to the left one zone per scan, then released while sliding
+    memset(&counts, 0, sizeof(counts));
+    for (int zone = 6; zone >= 1; zone--)
+    {
+        feed(&t, &now, zones(zone, zone), &counts);
+        feed(&t, &now, zones(zone - 1, zone), &counts);
+    }
+    feed(&t, &now, 0, &counts);
+    CHECK(counts.started == 1 && counts.continued >= 2 && counts.ended == 1, "slide left: %d started %d continued %d ended",
+          counts.started, counts.continued, counts.ended);
+    CHECK(counts.last_left, "slide left: direction");
+}
+
+static void test_reversal()
+{
+    slide_tracker_t t = {0};
+    counts_t counts = {0};
+    uint32_t now = 0;
+    for (int zone = 2; zone <= 5; zone++)
+        for (int i = 0; i < 2; i++)
+            feed(&t, &now, zones(zone, zone), &counts);
+    // one zone back is not enough to reverse, two are
+    for (int i = 0; i < 3; i++)
+        feed(&t, &now, zones(4, 4), &counts);
+    CHECK(counts.started == 1 && counts.continued == 2 && !counts.last_left, "reversal: %d started %d continued",
+          counts.started, counts.continued);
+    for (int i = 0; i < 2; i++)
+        feed(&t, &now, zones(3, 3), &counts);
+    CHECK(counts.continued == 3 && counts.last_left, "reversal: %d continued left %d", counts.continued, counts.last_left);
+}
+
+int main()
+{
+    test_border_rest();
+    test_widening();
+    test_slide();
+    test_reversal();
+    printf("slide: %s\n", s_failures ? "FAILED" : "passed");
+    return s_failures ? 1 : 0;
+}
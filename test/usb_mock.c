@@ -0,0 +1,388 @@
+/**
+ * Ipega Diva Plus host tests
+ *
+ * Mock tinyusb device controller port and scripted USB host
+ */
+#include <pthread.h>
+#include <string.h>
+
+#include "bsp/board.h"
+#include "tusb.h"
+#include "device/dcd.h"
+
+#include "usb_mock.h"
+#include "sim.h"
+
+#define EP0_SIZE      CFG_TUD_ENDPOINT0_SIZE
+#define EP_BUF_SIZE   256
+#define PUMP_LIMIT    100000 // pump() calls before a NAKing control transfer times out
+
+typedef struct mock_ep_s {
+    bool     opened;
+    bool     armed;
+    bool     stalled;
+    uint16_t mps;
+    uint8_t  *buf;
+    uint16_t total;
+    uint16_t done;
+    uint8_t  data[EP_BUF_SIZE]; // IN data as it was when armed
+} mock_ep_t;
+
+// s_hw_lock guards the controller state, s_int_lock is the USB IRQ being masked (dcd_int_disable)
+static pthread_mutex_t s_hw_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t s_int_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool s_int_masked; // device side only, tinyusb also enables the IRQ without disabling it first
+static mock_ep_t s_ep[16][2];
+static bool s_connected;
+static uint8_t s_address;
+static uint8_t s_pending_address;
+static usb_mock_stats_t s_stats;
+
+static mock_ep_t *get_ep(uint8_t ep_addr)
+{
+    return &s_ep[tu_edpt_number(ep_addr)][tu_edpt_dir(ep_addr)];
+}
+
+static void reset_endpoints(int first)
+{
+    for (int n = first; n < 16; n++)
+        memset(s_ep[n], 0, sizeof(s_ep[n]));
+    for (int d = 0; d < 2; d++)
+    {
+        s_ep[0][d].opened = true;
+        s_ep[0][d].mps = EP0_SIZE;
+    }
+}
+
+//--------------------------------------------------------------------+
+// dcd port
+//--------------------------------------------------------------------+
+
+#if TUSB_VERSION_MINOR >= 17
+bool dcd_init(uint8_t rhport, const tusb_rhport_init_t *rh_init)
+{
+    (void)rh_init;
+#else
+void dcd_init(uint8_t rhport)
+{
+#endif
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    reset_endpoints(0);
+    s_connected = true;
+    s_address = 0;
+    pthread_mutex_unlock(&s_hw_lock);
+#if TUSB_VERSION_MINOR >= 17
+    return true;
+#endif
+}
+
+void dcd_int_handler(uint8_t rhport) { (void)rhport; }
+
+void dcd_int_enable(uint8_t rhport)
+{
+    (void)rhport;
+    if (s_int_masked)
+    {
+        s_int_masked = false;
+        pthread_mutex_unlock(&s_int_lock);
+    }
+}
+
+void dcd_int_disable(uint8_t rhport)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_int_lock);
+    s_int_masked = true;
+}
+
+void dcd_set_address(uint8_t rhport, uint8_t dev_addr)
+{
+    // the new address is only used after the status stage, which the port has to send itself
+    pthread_mutex_lock(&s_hw_lock);
+    s_pending_address = dev_addr;
+    pthread_mutex_unlock(&s_hw_lock);
+    dcd_edpt_xfer(rhport, 0x80, NULL, 0);
+}
+
+void dcd_remote_wakeup(uint8_t rhport) { (void)rhport; }
+
+void dcd_connect(uint8_t rhport)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    s_connected = true;
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+void dcd_disconnect(uint8_t rhport)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    s_connected = false;
+    s_stats.disconnects++;
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+void dcd_sof_enable(uint8_t rhport, bool en)
+{
+    (void)rhport;
+    (void)en;
+}
+
+uint32_t tusb_time_millis_api(void)
+{
+    return board_millis();
+}
+
+bool dcd_edpt_open(uint8_t rhport, tusb_desc_endpoint_t const *desc_ep)
+{
+    (void)rhport;
+    const uint8_t *d = (const uint8_t *)desc_ep;
+    pthread_mutex_lock(&s_hw_lock);
+    mock_ep_t *ep = get_ep(d[2]);
+    memset(ep, 0, sizeof(*ep));
+    ep->opened = true;
+    ep->mps = (d[4] | (d[5] << 8)) & 0x7FF;
+    pthread_mutex_unlock(&s_hw_lock);
+    return true;
+}
+
+void dcd_edpt_close_all(uint8_t rhport)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    reset_endpoints(1);
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+void dcd_edpt_close(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    memset(get_ep(ep_addr), 0, sizeof(mock_ep_t));
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+bool dcd_edpt_xfer(uint8_t rhport, uint8_t ep_addr, uint8_t *buffer, uint16_t total_bytes)
+{
+    (void)rhport;
+    sim_preempt();
+    pthread_mutex_lock(&s_hw_lock);
+    mock_ep_t *ep = get_ep(ep_addr);
+    bool ok = ep->opened && total_bytes <= EP_BUF_SIZE;
+    if (ok)
+    {
+        // EP0 gets re-armed when a SETUP supersedes a control transfer left over from before a detach,
+        // the RP2040 port resets the endpoint in that case too
+        if (ep->armed && tu_edpt_number(ep_addr))
+            s_stats.rearmed_busy++;
+        ep->armed = true;
+        ep->buf = buffer;
+        ep->total = total_bytes;
+        ep->done = 0;
+        if (tu_edpt_dir(ep_addr) == TUSB_DIR_IN && total_bytes)
+            memcpy(ep->data, buffer, total_bytes);
+    }
+    pthread_mutex_unlock(&s_hw_lock);
+    return ok;
+}
+
+void dcd_edpt_stall(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    mock_ep_t *ep = get_ep(ep_addr);
+    ep->stalled = true;
+    ep->armed = false;
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+void dcd_edpt_clear_stall(uint8_t rhport, uint8_t ep_addr)
+{
+    (void)rhport;
+    pthread_mutex_lock(&s_hw_lock);
+    get_ep(ep_addr)->stalled = false;
+    pthread_mutex_unlock(&s_hw_lock);
+}
+
+//--------------------------------------------------------------------+
+// Host side
+//--------------------------------------------------------------------+
+
+static void post_xfer_complete(uint8_t ep_addr, uint16_t len)
+{
+    pthread_mutex_lock(&s_int_lock);
+    dcd_event_xfer_complete(0, ep_addr, len, XFER_RESULT_SUCCESS, true);
+    pthread_mutex_unlock(&s_int_lock);
+}
+
+void usb_host_bus_reset(void)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    reset_endpoints(0);
+    s_address = 0;
+    pthread_mutex_unlock(&s_hw_lock);
+
+    pthread_mutex_lock(&s_int_lock);
+    dcd_event_bus_reset(0, TUSB_SPEED_FULL, true);
+    pthread_mutex_unlock(&s_int_lock);
+}
+
+void usb_host_setup(const tusb_control_request_t *req)
+{
+    // a SETUP packet always gets through, and cancels whatever EP0 was doing
+    pthread_mutex_lock(&s_hw_lock);
+    for (int d = 0; d < 2; d++)
+    {
+        s_ep[0][d].armed = false;
+        s_ep[0][d].stalled = false;
+    }
+    pthread_mutex_unlock(&s_hw_lock);
+
+    pthread_mutex_lock(&s_int_lock);
+    dcd_event_setup_received(0, (const uint8_t *)req, true);
+    pthread_mutex_unlock(&s_int_lock);
+}
+
+int usb_host_in(uint8_t ep_addr, uint8_t *buf, uint16_t max)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    mock_ep_t *ep = get_ep(ep_addr);
+    if (!s_connected || ep->stalled || !ep->armed)
+    {
+        int ret = !s_connected ? USB_TIMEOUT : ep->stalled ? USB_STALL : USB_NAK; // no handshake from a detached device
+        pthread_mutex_unlock(&s_hw_lock);
+        return ret;
+    }
+
+    uint16_t len = ep->total - ep->done;
+    if (len > ep->mps)
+        len = ep->mps;
+    if (len > max)
+        len = max;
+    if (len)
+        memcpy(buf, ep->data + ep->done, len);
+    ep->done += len;
+    if (tu_edpt_number(ep_addr))
+        s_stats.in_packets++;
+
+    bool complete = (ep->done == ep->total) || (len < ep->mps);
+    uint16_t done = ep->done;
+    if (complete)
+    {
+        ep->armed = false;
+        if (ep_addr == 0x80 && s_pending_address)
+        {
+            s_address = s_pending_address;
+            s_pending_address = 0;
+        }
+    }
+    pthread_mutex_unlock(&s_hw_lock);
+
+    if (complete)
+        post_xfer_complete(ep_addr, done);
+    return len;
+}
+
+int usb_host_out(uint8_t ep_addr, const uint8_t *buf, uint16_t len)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    mock_ep_t *ep = get_ep(ep_addr);
+    if (!s_connected || ep->stalled || !ep->armed)
+    {
+        int ret = !s_connected ? USB_TIMEOUT : ep->stalled ? USB_STALL : USB_NAK; // no handshake from a detached device
+        pthread_mutex_unlock(&s_hw_lock);
+        return ret;
+    }
+
+    if (len > ep->total - ep->done)
+        len = ep->total - ep->done;
+    if (len)
+        memcpy(ep->buf + ep->done, buf, len);
+    ep->done += len;
+
+    bool complete = (ep->done == ep->total) || (len < ep->mps);
+    uint16_t done = ep->done;
+    if (complete)
+        ep->armed = false;
+    pthread_mutex_unlock(&s_hw_lock);
+
+    if (complete)
+        post_xfer_complete(ep_addr, done);
+    return len;
+}
+
+// retries a transaction while the device NAKs
+static int transact(uint8_t ep_addr, uint8_t *buf, uint16_t len, void (*pump)(void))
+{
+    for (int i = 0; i < PUMP_LIMIT; i++)
+    {
+        int ret = (ep_addr & 0x80) ? usb_host_in(ep_addr, buf, len) : usb_host_out(ep_addr, buf, len);
+        if (ret != USB_NAK)
+            return ret;
+        pump();
+    }
+    return USB_TIMEOUT;
+}
+
+int usb_host_control(const tusb_control_request_t *req, uint8_t *data, void (*pump)(void))
+{
+    usb_host_setup(req);
+
+    int total = 0;
+    int ret;
+    if (req->wLength && (req->bmRequestType & 0x80))
+    {
+        while (total < req->wLength)
+        {
+            ret = transact(0x80, data + total, req->wLength - total, pump);
+            if (ret < 0)
+                return ret;
+            total += ret;
+            if (ret < EP0_SIZE)
+                break;
+        }
+        ret = transact(0x00, NULL, 0, pump);
+    }
+    else if (req->wLength)
+    {
+        while (total < req->wLength)
+        {
+            uint16_t len = (req->wLength - total < EP0_SIZE) ? req->wLength - total : EP0_SIZE;
+            ret = transact(0x00, data + total, len, pump);
+            if (ret < 0)
+                return ret;
+            total += len;
+        }
+        ret = transact(0x80, NULL, 0, pump);
+    }
+    else
+        ret = transact(0x80, NULL, 0, pump);
+
+    return (ret < 0) ? ret : total;
+}
+
+bool usb_device_connected(void)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    bool connected = s_connected;
+    pthread_mutex_unlock(&s_hw_lock);
+    return connected;
+}
+
+uint8_t usb_device_address(void)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    uint8_t address = s_address;
+    pthread_mutex_unlock(&s_hw_lock);
+    return address;
+}
+
+usb_mock_stats_t usb_mock_stats(void)
+{
+    pthread_mutex_lock(&s_hw_lock);
+    usb_mock_stats_t stats = s_stats;
+    pthread_mutex_unlock(&s_hw_lock);
+    return stats;
+}
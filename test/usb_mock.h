@@ -0,0 +1,41 @@
+#ifndef USB_MOCK_H_
+#define USB_MOCK_H_
+
+/* tinyusb device controller (dcd_*) port for the host tests, plus the host side of the bus.
+ *
+ * IN data is copied when the endpoint is armed, like the RP2040 port does into its DPRAM
+ * (this matters: tinyusb builds GET_REPORT replies in the HID IN buffer, even with a report in flight),
+ * and the host side then sees the packets one token at a time. Events are posted to the
+ * stack under dcd_int_disable()/dcd_int_enable() exclusion as if they came from the USB IRQ.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tusb.h"
+
+#define USB_NAK     (-1)
+#define USB_STALL   (-2)
+#define USB_TIMEOUT (-3)
+
+typedef struct usb_mock_stats_s {
+    uint32_t rearmed_busy; // dcd_edpt_xfer() on a non control endpoint with a transfer still pending
+    uint32_t in_packets;   // non control IN packets delivered
+    uint32_t disconnects;  // dcd_disconnect() calls (mode switch)
+} usb_mock_stats_t;
+
+// host side, one transaction each, return the packet length or USB_NAK / USB_STALL (USB_TIMEOUT when detached)
+void usb_host_bus_reset(void);
+void usb_host_setup(const tusb_control_request_t *req);
+int usb_host_in(uint8_t ep_addr, uint8_t *buf, uint16_t max);
+int usb_host_out(uint8_t ep_addr, const uint8_t *buf, uint16_t len);
+
+// whole control transfer, pump() is called while the device NAKs (runs the device or waits for it),
+// returns the data stage length or USB_STALL / USB_TIMEOUT
+int usb_host_control(const tusb_control_request_t *req, uint8_t *data, void (*pump)(void));
+
+bool usb_device_connected(void);
+uint8_t usb_device_address(void);
+usb_mock_stats_t usb_mock_stats(void);
+
+#endif /* USB_MOCK_H_ */
@@ -0,0 +1,665 @@
+/**
+ * Ipega Diva Plus host tests
+ *
+ * Runs the firmware's core 0 loop (slider decode) and core 1 loop (USB and buttons) against the mock
+ * controller port in simulated time, with an emulated Ipega MCU scanning the slider on the i2c bus:
+ * enumerates like a host does, compares the descriptors and the report sequence of a scripted input
+ * scenario with the golden files, measures input to IN token latency and checks the feature reports.
+ *
+ * usage: usb_test joy|kb (UPDATE_GOLDEN=1 rewrites the golden files instead of comparing)
+ */
+#define main firmware_main
+#include "../main.c"
+#undef main
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "sim.h"
+#include "usb_mock.h"
+
+#define CORE1_PASS_US 5     // simulated duration of one core 1 loop pass
+#define HALF_SCAN_US  500   // Ipega MCU reads one slider half every HALF_SCAN_US
+#define SCENARIO_US   120000
+#define MAX_REPORTS   512
+#define MAX_EVENTS    512
+
+typedef struct step_s {
+    uint32_t at_us; // from the scenario start
+    uint8_t  pin;   // button gpio or ZONE()
+    bool     pressed;
+} step_t;
+
+#define ZONE(z)       (64 + (z)) // Ipega slider pair zone z (cells 2+2z and 3+2z)
+#define IS_ZONE(pin)  ((pin) >= 64)
+#define ZONE_CELLS(pin) (3u << (28 - 2 * ((pin) - 64))) // cell 0 is bit 31
+
+// held presses long enough for the face button debounce, then a tap shorter than a report interval,
+// a slider zone touch and a slide across zones of the second slider half
+static const step_t s_steps[] = {
+    {1000,  PIN_CROSS,    true},
+    {11000, PIN_CROSS,    false},
+    {21000, PIN_TRIANGLE, true},
+    {26000, PIN_CIRCLE,   true},
+    {36000, PIN_TRIANGLE, false},
+    {41000, PIN_CIRCLE,   false},
+    {51000, PIN_L1,       true},
+    {51100, PIN_L1,       false},
+    {61000, PIN_UP,       true},
+    {71000, PIN_UP,       false},
+    {76000, ZONE(3),      true},
+    {86000, ZONE(3),      false},
+    {91000, ZONE(9),      true},
+    {94000, ZONE(10),     true},
+    {95000, ZONE(9),      false},
+    {98000, ZONE(11),     true},
+    {99000, ZONE(10),     false},
+    {105000, ZONE(11),    false},
+};
+
+#if INPUT_EVENT_REPORT
+// several edges per core 1 pass, a bouncing face button press and a face button tap shorter than the debounce
+#define BURST_PASS_US 400
+#define BURST_US      40000
+
+static const step_t s_burst_steps[] = {
+    {1000,  PIN_SQUARE, true},
+    {1100,  PIN_R1,     true},
+    {1200,  PIN_R1,     false},
+    {1300,  PIN_L1,     true},
+    {1400,  PIN_L1,     false},
+    {5000,  PIN_SQUARE, false},
+    {10000, PIN_CROSS,  true},
+    {10100, PIN_CROSS,  false},
+    {10200, PIN_CROSS,  true},
+    {20000, PIN_CROSS,  false},
+    {30000, PIN_CIRCLE, true},
+    {30500, PIN_CIRCLE, false},
+};
+
+// expected button events, at the sampler tick after the edge or at the end of the press hold
+static const step_t s_burst_events[] = {
+    {1010,  PIN_SQUARE, true},
+    {1110,  PIN_R1,     true},
+    {1210,  PIN_R1,     false},
+    {1310,  PIN_L1,     true},
+    {1410,  PIN_L1,     false},
+    {5010,  PIN_SQUARE, false},
+    {10010, PIN_CROSS,  true},
+    {20010, PIN_CROSS,  false},
+    {30010, PIN_CIRCLE, true},
+    {30010 + DEBOUNCE_US, PIN_CIRCLE, false},
+};
+#endif
+
+typedef struct delivered_s {
+    uint32_t us;
+    uint8_t  len;
+    uint8_t  data[64];
+} delivered_t;
+
+static const char *s_variant;
+static int s_failures = 0;
+static uint8_t s_desc_config[256];
+static uint8_t s_itf_count = 0;
+static uint8_t s_itf_ep[4];
+static uint16_t s_itf_report_len[4];
+
+#define CHECK(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s: FAIL line %d: ", s_variant, __LINE__); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        s_failures++; \
+    } } while (0)
+
+//--------------------------------------------------------------------+
+// Ipega MCU: reads the touched cells one half at a time on the i2c bus
+//--------------------------------------------------------------------+
+
+static uint32_t s_touched = 0;
+static uint8_t s_half = 1;
+static uint32_t s_next_scan_us = 0;
+
+static void push(uint32_t ev, uint8_t data)
+{
+    sim_i2c_push((ev << 10) | ((uint32_t)data << 1));
+}
+
+static void ipega_scan()
+{
+    uint8_t offset = (s_half == 1) ? 0 : 8;
+    push(EV_START, 0);
+    push(EV_DATA, 0x58);
+    push(EV_DATA, s_half);
+    push(EV_STOP, 0);
+    push(EV_START, 0);
+    push(EV_DATA, 0x59);
+    for (int idx = 1; idx <= 9; idx++)
+    {
+        uint8_t data = 0;
+        if ((idx % 3 == 1) && (s_touched & s_tab0f[idx + offset]))
+            data |= 0x0F;
+        if ((idx % 3 != 0) && (s_touched & s_tabf0[idx + offset]))
+            data |= 0xF0;
+        push(EV_DATA, data);
+    }
+    push(EV_STOP, 0);
+    s_half = (s_half == 1) ? 2 : 1;
+}
+
+static void set_input(const step_t *step)
+{
+    if (!IS_ZONE(step->pin))
+        sim_set_pressed(step->pin, step->pressed);
+    else if (step->pressed)
+        s_touched |= ZONE_CELLS(step->pin);
+    else
+        s_touched &= ~ZONE_CELLS(step->pin);
+}
+
+// core 0 decodes the bus traffic in no simulated time, then one core 1 pass
+static void pump()
+{
+    if ((int32_t)(time_us_32() - s_next_scan_us) >= 0)
+    {
+        s_next_scan_us += HALF_SCAN_US;
+        ipega_scan();
+    }
+    do
+        core0_poll();
+    while (!sim_i2c_idle());
+    core1_poll();
+    sim_advance_us(CORE1_PASS_US);
+}
+
+static int control(uint8_t type, uint8_t request, uint16_t value, uint16_t index, uint16_t length, void *data)
+{
+    tusb_control_request_t req = {.bmRequestType = type, .bRequest = request, .wValue = value,
+                                  .wIndex = index, .wLength = length};
+    return usb_host_control(&req, data, pump);
+}
+
+//--------------------------------------------------------------------+
+// Golden files
+//--------------------------------------------------------------------+
+
+static void hex_lines(FILE *f, const uint8_t *data, int len)
+{
+    for (int i = 0; i < len; i++)
+        fprintf(f, "%02x%c", data[i], (i % 16 == 15 || i == len - 1) ? '\n' : ' ');
+}
+
+static void golden(const char *name, const char *text, size_t size)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s/%s", GOLDEN_DIR, s_variant, name);
+
+    const char *update = getenv("UPDATE_GOLDEN");
+    if (update && *update && *update != '0')
+    {
+        FILE *f = fopen(path, "w");
+        CHECK(f, "cannot write %s", path);
+        if (f)
+        {
+            fwrite(text, 1, size, f);
+            fclose(f);
+        }
+        return;
+    }
+
+    char *expected = calloc(1, size + 2);
+    FILE *f = fopen(path, "r");
+    size_t len = f ? fread(expected, 1, size + 1, f) : 0;
+    if (f)
+        fclose(f);
+    CHECK(f && len == size && !memcmp(text, expected, size), "%s differs from the golden file, got:\n%.*s", path, (int)size, text);
+    free(expected);
+}
+
+static void golden_hex(const char *name, const uint8_t *data, int len)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&text, &size);
+    hex_lines(f, data, len);
+    fclose(f);
+    golden(name, text, size);
+    free(text);
+}
+
+//--------------------------------------------------------------------+
+// Enumeration
+//--------------------------------------------------------------------+
+
+static void enumerate()
+{
+    uint8_t buf[256];
+
+    // Linux style: 64 bytes device descriptor read at address 0, second reset, then SET_ADDRESS
+    usb_host_bus_reset();
+    int len = control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_DEVICE << 8, 0, 64, buf);
+    CHECK(len == 18, "device descriptor at address 0: %d", len);
+    usb_host_bus_reset();
+    CHECK(control(0x00, TUSB_REQ_SET_ADDRESS, 5, 0, 0, NULL) == 0, "SET_ADDRESS");
+    CHECK(usb_device_address() == 5, "address %u", usb_device_address());
+
+    len = control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_DEVICE << 8, 0, 18, buf);
+    CHECK(len == 18, "device descriptor: %d", len);
+    golden_hex("desc_device.hex", buf, len);
+    uint8_t product_idx = ((tusb_desc_device_t *)buf)->iProduct;
+
+    len = control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_CONFIGURATION << 8, 0, 9, buf);
+    CHECK(len == 9, "configuration descriptor header: %d", len);
+    uint16_t total = buf[2] | (buf[3] << 8);
+    len = control(0x80, TUSB_REQ_GET_DESCRIPTOR, TUSB_DESC_CONFIGURATION << 8, 0, total, s_desc_config);
+    CHECK(len == total && total <= sizeof(s_desc_config), "configuration descriptor: %d of %u", len, total);
+    golden_hex("desc_configuration.hex", s_desc_config, len);
+
+    // interfaces with their report descriptor length and IN endpoint
+    for (int i = 0; i + 2 <= len && s_desc_config[i]; i += s_desc_config[i])
+    {
+        const uint8_t *d = &s_desc_config[i];
+        if (d[1] == TUSB_DESC_INTERFACE && s_itf_count < count_of(s_itf_ep))
+            s_itf_count++;
+        else if (d[1] == HID_DESC_TYPE_HID && s_itf_count)
+            s_itf_report_len[s_itf_count - 1] = d[7] | (d[8] << 8);
+        else if (d[1] == TUSB_DESC_ENDPOINT && s_itf_count)
+            s_itf_ep[s_itf_count - 1] = d[2];
+    }
+    CHECK(s_itf_count == CFG_TUD_HID, "%u interfaces", s_itf_count);
+
+    const char *product = g_kb_mode ? "Ipega Diva Deluxe (KB)" : "Ipega Diva Deluxe";
+    len = control(0x80, TUSB_REQ_GET_DESCRIPTOR, (TUSB_DESC_STRING << 8) | product_idx, 0x0409, 255, buf);
+    CHECK(len == 2 + 2 * (int)strlen(product), "product string: %d", len);
+    for (int i = 0; i < (int)strlen(product) && i * 2 + 2 < len; i++)
+        CHECK(buf[2 + 2 * i] == product[i], "product string char %d", i);
+
+    CHECK(!tud_mounted(), "mounted before SET_CONFIGURATION");
+    CHECK(control(0x00, TUSB_REQ_SET_CONFIGURATION, 1, 0, 0, NULL) == 0, "SET_CONFIGURATION");
+    pump();
+    CHECK(tud_mounted(), "not mounted");
+
+    for (int itf = 0; itf < s_itf_count; itf++)
+    {
+        char name[64];
+        CHECK(control(0x21, HID_REQ_CONTROL_SET_IDLE, 0, itf, 0, NULL) == 0, "SET_IDLE %d", itf);
+        len = control(0x81, TUSB_REQ_GET_DESCRIPTOR, HID_DESC_TYPE_REPORT << 8, itf, s_itf_report_len[itf], buf);
+        CHECK(len == s_itf_report_len[itf], "report descriptor %d: %d", itf, len);
+        snprintf(name, sizeof(name), "desc_hid_report_%d.hex", itf);
+        golden_hex(name, buf, len);
+    }
+
+    // unsupported request (BOS descriptor) must stall
+    CHECK(control(0x80, TUSB_REQ_GET_DESCRIPTOR, 0x0F << 8, 0, 5, buf) == USB_STALL, "BOS request not stalled");
+}
+
+//--------------------------------------------------------------------+
+// Scripted input, latency
+//--------------------------------------------------------------------+
+
+// state of the button on gpio pin in a gamepad/keyboard report, -1 when the report does not carry it
+static int report_state(const delivered_t *r, uint8_t pin)
+{
+    if (IS_ZONE(pin))
+    {
+        if (g_kb_mode)
+            return -1; // keys span several zones
+        uint32_t slider = (r->data[3] | (r->data[4] << 8) | (r->data[5] << 16) | ((uint32_t)r->data[6] << 24)) ^ 0x80808080;
+        return (slider & ZONE_CELLS(pin)) == ZONE_CELLS(pin);
+    }
+
+    if (g_kb_mode)
+    {
+        int key = -1;
+        for (int i = 0; i < 4; i++)
+            if (g_but_pin[i] == pin)
+                key = SW_KEYCODE[i];
+        return (key < 0) ? -1 : (r->data[key / 8 + 1] >> (key % 8)) & 1;
+    }
+
+    uint16_t buttons = r->data[0] | (r->data[1] << 8);
+    switch (pin)
+    {
+        case PIN_TRIANGLE: return !!(buttons & X_MASK_ON);
+        case PIN_SQUARE:   return !!(buttons & Y_MASK_ON);
+        case PIN_CROSS:    return !!(buttons & B_MASK_ON);
+        case PIN_CIRCLE:   return !!(buttons & A_MASK_ON);
+        case PIN_L1:       return !!(buttons & LB_MASK_ON);
+        case PIN_UP:       return r->data[2] == DPAD_UP_MASK_ON;
+        default:           return -1;
+    }
+}
+
+static int button_index(uint8_t pin)
+{
+    for (int i = 0; i < NUM_BUTTONS; i++)
+        if (g_but_pin[i] == pin)
+            return i;
+    return -1;
+}
+
+static void run_scenario(uint32_t interval_us)
+{
+    static delivered_t reports[MAX_REPORTS];
+    static timed_event_t events[MAX_EVENTS];
+    static uint32_t event_in_us[MAX_EVENTS]; // host poll which got the event
+    int report_count = 0;
+    int event_count = 0;
+    int event_seq = -1;
+    delivered_t last = {0};
+
+    while (time_us_32() % 10)
+        pump(); // scripted edges right after a sampler tick
+    uint32_t start = time_us_32();
+    uint32_t next_poll = start;
+    size_t step = 0;
+    while (time_us_32() - start < SCENARIO_US)
+    {
+        uint32_t now = time_us_32();
+        for (; step < count_of(s_steps) && now - start >= s_steps[step].at_us; step++)
+            set_input(&s_steps[step]);
+
+        if ((int32_t)(now - next_poll) >= 0)
+        {
+            next_poll += interval_us;
+            delivered_t r = {.us = now - start};
+            int len = usb_host_in(s_itf_ep[0], r.data, sizeof(r.data));
+            if (len > 0)
+            {
+                r.len = len;
+                if ((r.len != last.len || memcmp(r.data, last.data, r.len)) && report_count < MAX_REPORTS)
+                    reports[report_count++] = r;
+                last = r;
+            }
+#if INPUT_EVENT_REPORT
+            event_report_t er;
+            if (usb_host_in(s_itf_ep[HID_INSTANCE_EVENTS], (uint8_t *)&er, sizeof(er)) == sizeof(er))
+            {
+                CHECK(event_seq < 0 || er.seq == (uint8_t)(event_seq + 1), "event report seq %u after %d", er.seq, event_seq);
+                event_seq = er.seq;
+                for (int i = 0; i < er.count && event_count < MAX_EVENTS; i++)
+                {
+                    event_in_us[event_count] = now - start;
+                    events[event_count++] = (timed_event_t){er.base_us + er.events[i].dt_us - start, er.events[i].id, er.events[i].state};
+                }
+            }
+#endif
+        }
+        pump();
+    }
+    (void)events;
+    (void)event_in_us;
+    (void)event_count;
+    (void)event_seq;
+
+    // report sequence
+    char *text = NULL;
+    size_t size = 0;
+    FILE *f = open_memstream(&text, &size);
+    for (int i = 0; i < report_count; i++)
+    {
+        fprintf(f, "%6u ", reports[i].us);
+        for (int j = 0; j < reports[i].len; j++)
+            fprintf(f, "%02x", reports[i].data[j]);
+        fputc('\n', f);
+    }
+    fclose(f);
+    char name[64];
+    snprintf(name, sizeof(name), "reports_%u.txt", interval_us);
+    golden(name, text, size);
+    free(text);
+
+    // every scripted change reaches the host in time, in a report of its own (slider changes wait for the next scan of their half)
+    uint32_t min = UINT32_MAX, max = 0, sum = 0, count = 0;
+    for (size_t s = 0; s < count_of(s_steps); s++)
+    {
+        uint32_t bound = 2 * interval_us + 1000 + (IS_ZONE(s_steps[s].pin) ? 2 * HALF_SCAN_US : 0);
+        if (s > 0 && s_steps[s - 1].pin == s_steps[s].pin && s_steps[s].at_us - s_steps[s - 1].at_us < 1000)
+            bound += 1000; // release of a latched tap, sent after the report carrying the press
+        int i = 0;
+        while (i < report_count && (reports[i].us <= s_steps[s].at_us || report_state(&reports[i], s_steps[s].pin) != s_steps[s].pressed))
+            i++;
+        if (report_state(&last, s_steps[s].pin) < 0)
+            continue;
+        CHECK(i < report_count, "step %zu (pin %u %s) never reported", s, s_steps[s].pin, s_steps[s].pressed ? "press" : "release");
+        if (i == report_count)
+            continue;
+        uint32_t latency = reports[i].us - s_steps[s].at_us;
+        CHECK(latency <= bound, "step %zu latency %u us above %u us", s, latency, bound);
+        min = (latency < min) ? latency : min;
+        max = (latency > max) ? latency : max;
+        sum += latency;
+        count++;
+    }
+    printf("%s: %u us polling, input to IN token min %u avg %u max %u us (%u changes, %d reports)\n",
+           s_variant, interval_us, min, count ? sum / count : 0, max, count, report_count);
+
+#if INPUT_EVENT_REPORT
+    // every button edge is in the event stream with the time the sampler saw it
+    snprintf(name, sizeof(name), "events_%u.txt", interval_us);
+    f = open_memstream(&text, &size);
+    for (int i = 0; i < event_count; i++)
+        fprintf(f, "%6u %3u %u\n", events[i].us, events[i].id, events[i].state);
+    fclose(f);
+    golden(name, text, size);
+    free(text);
+
+    for (size_t s = 0; s < count_of(s_steps); s++)
+    {
+        bool found = false;
+        if (IS_ZONE(s_steps[s].pin))
+        {
+            // both cells of the zone, with the time of the scan which carried them
+            int cells = 0;
+            for (int i = 0; i < event_count; i++)
+                cells += INPUT_ID_IS_SLIDER(events[i].id) && (ZONE_CELLS(s_steps[s].pin) >> (events[i].id - INPUT_ID_SLIDER(0)) & 1)
+                         && events[i].state == s_steps[s].pressed && events[i].us - s_steps[s].at_us <= 2 * HALF_SCAN_US;
+            CHECK(cells == 2, "step %zu: %d zone cell events", s, cells);
+            continue;
+        }
+        uint32_t sampled_us = s_steps[s].at_us + 10; // next sampler tick
+        for (int i = 0; i < event_count && !found; i++)
+            found = events[i].id == INPUT_ID_BUTTON(button_index(s_steps[s].pin)) && events[i].state == s_steps[s].pressed && events[i].us == sampled_us;
+        CHECK(found, "step %zu missing from the event stream (expected at %u us)", s, sampled_us);
+    }
+
+    // at full speed polling, every event goes out with the first IN token after it, also when other events of
+    // the same polling interval are already waiting (only the ones queued after the endpoint was armed wait one more)
+    if (interval_us == EVENT_POLL_US)
+        for (int i = 0; i < event_count; i++)
+        {
+            uint32_t token_us = (events[i].us / interval_us + 1) * interval_us;
+            bool late_ok = token_us - events[i].us <= EVENT_ARM_GUARD_US + CORE1_PASS_US;
+            CHECK(event_in_us[i] == token_us || (late_ok && event_in_us[i] == token_us + interval_us),
+                  "event %u %u at %u us delivered at %u us", events[i].id, events[i].state, events[i].us, event_in_us[i]);
+        }
+
+#if SLIDE_TRACKING
+    // the slide from zone 9 to 11: started on zone 10 (center cell 23), continued on 11 (cell 25), ended on release
+    static const uint8_t slide[] = {SLIDE_STATE(SLIDE_STARTED, 23, false), SLIDE_STATE(SLIDE_CONTINUED, 25, false),
+                                    SLIDE_STATE(SLIDE_ENDED, 25, false)};
+    int slide_events = 0;
+    for (int i = 0; i < event_count; i++)
+    {
+        if (!INPUT_ID_IS_SLIDE(events[i].id))
+            continue;
+        CHECK(slide_events < (int)count_of(slide) && events[i].state == slide[slide_events],
+              "slide event %d state %02x at %u us", slide_events, events[i].state, events[i].us);
+        slide_events++;
+    }
+    CHECK(slide_events == count_of(slide), "%d slide events", slide_events);
+#endif
+#endif
+}
+
+// core 1 stalled while the sampler DMA goes round its ring, exactly once and then partly:
+// the state must follow the pins, not stay stale or replay overwritten samples
+static void check_ring_overrun()
+{
+    uint32_t r1 = 1u << button_index(PIN_R1);
+    uint32_t l1 = 1u << button_index(PIN_L1);
+    for (int laps = 0; laps < 2; laps++)
+    {
+        sim_set_pressed(PIN_R1, true);
+        for (int i = 0; i < 10; i++)
+            pump();
+        CHECK((g_button_state & r1) && !(g_button_state & l1), "overrun %d: R1 press not seen", laps);
+
+        // 64 samples (one whole lap) then 64 + 7
+        int toggles = laps ? 70 : 63;
+        sim_set_pressed(PIN_R1, false);
+        sim_advance_us(20);
+        for (int i = 0; i < toggles; i++)
+        {
+            sim_set_pressed(PIN_L1, !(i & 1));
+            sim_advance_us(20);
+        }
+        for (int i = 0; i < 10; i++)
+            pump();
+        CHECK(!(g_button_state & r1), "overrun %d: R1 stuck pressed", laps);
+        CHECK(!!(g_button_state & l1) == (toggles & 1), "overrun %d: L1 state %d", laps, !!(g_button_state & l1));
+
+        sim_set_pressed(PIN_L1, false);
+        for (int i = 0; i < 10; i++)
+            pump();
+    }
+}
+
+#if INPUT_EVENT_REPORT
+// slow core 1 passes: every edge drained in a same pass still gets its own event and sample time
+static void run_burst()
+{
+    static timed_event_t events[MAX_EVENTS];
+    int event_count = 0;
+
+    while (time_us_32() % 10)
+        pump();
+    uint32_t start = time_us_32();
+    uint32_t next_poll = start;
+    size_t step = 0;
+    while (time_us_32() - start < BURST_US)
+    {
+        uint32_t now = time_us_32();
+        if ((int32_t)(now - next_poll) >= 0)
+        {
+            uint8_t buf[64];
+            event_report_t er;
+            next_poll += 1000;
+            usb_host_in(s_itf_ep[0], buf, sizeof(buf));
+            if (usb_host_in(s_itf_ep[HID_INSTANCE_EVENTS], (uint8_t *)&er, sizeof(er)) == sizeof(er))
+                for (int i = 0; i < er.count && event_count < MAX_EVENTS; i++)
+                    events[event_count++] = (timed_event_t){er.base_us + er.events[i].dt_us - start, er.events[i].id, er.events[i].state};
+        }
+
+        core1_poll();
+        // edges land between two passes, several of them per pass
+        uint32_t pass_end = now + BURST_PASS_US;
+        for (; step < count_of(s_burst_steps) && s_burst_steps[step].at_us < pass_end - start; step++)
+        {
+            sim_advance_us(start + s_burst_steps[step].at_us - time_us_32());
+            sim_set_pressed(s_burst_steps[step].pin, s_burst_steps[step].pressed);
+        }
+        sim_advance_us(pass_end - time_us_32());
+    }
+
+    int button_events = 0;
+    for (int i = 0; i < event_count; i++)
+        button_events += INPUT_ID_IS_BUTTON(events[i].id);
+    CHECK(button_events == count_of(s_burst_events), "%d button events in the burst, expected %zu", button_events, count_of(s_burst_events));
+    for (size_t e = 0; e < count_of(s_burst_events); e++)
+    {
+        bool found = false;
+        for (int i = 0; i < event_count && !found; i++)
+            found = events[i].id == INPUT_ID_BUTTON(button_index(s_burst_events[e].pin)) && events[i].state == s_burst_events[e].pressed
+                    && events[i].us == s_burst_events[e].at_us;
+        CHECK(found, "burst event %zu (pin %u %s at %u us) missing", e, s_burst_events[e].pin,
+              s_burst_events[e].pressed ? "press" : "release", s_burst_events[e].at_us);
+    }
+}
+#endif
+
+//--------------------------------------------------------------------+
+// Feature reports
+//--------------------------------------------------------------------+
+
+static diag_report_t get_diag()
+{
+    diag_report_t diag = {0};
+    int len = control(0xA1, HID_REQ_CONTROL_GET_REPORT, (HID_REPORT_TYPE_FEATURE << 8) | 0, 0, 64, &diag);
+    CHECK(len == sizeof(diag), "diagnostics length %d", len);
+    return diag;
+}
+
+static void check_diag(uint32_t latched_presses, uint32_t max_latency_us)
+{
+    diag_report_t diag = get_diag();
+    CHECK(diag.version == DIAG_REPORT_VERSION && diag.size == sizeof(diag), "diag version %u size %u", diag.version, diag.size);
+    CHECK(diag.latched_presses == latched_presses, "latched presses %u, expected %u", diag.latched_presses, latched_presses);
+    CHECK(diag.mount_us > 0, "mount time not set");
+    CHECK(diag.first_report_us >= diag.mount_us, "first report %u us before mount %u us", diag.first_report_us, diag.mount_us);
+    CHECK(diag.in_latency_samples > 0, "no IN latency sample");
+    CHECK(diag.in_latency_min_us <= diag.in_latency_avg_us && diag.in_latency_avg_us <= diag.in_latency_max_us,
+          "IN latency min %u avg %u max %u", diag.in_latency_min_us, diag.in_latency_avg_us, diag.in_latency_max_us);
+    CHECK(diag.in_latency_max_us <= max_latency_us, "IN latency max %u us", diag.in_latency_max_us);
+    CHECK(diag.slide_contacts == 0, "%u slide contacts with the slider released", diag.slide_contacts);
+    CHECK(diag.sniffer_restarts == 0, "%u sniffer restarts", diag.sniffer_restarts);
+    CHECK(diag.scan_period_us == 2 * HALF_SCAN_US, "scan period %u us", diag.scan_period_us);
+    printf("%s: device input to IN completion min %u avg %u max %u us (%u samples), latched presses %u\n", s_variant,
+           diag.in_latency_min_us, diag.in_latency_avg_us, diag.in_latency_max_us, diag.in_latency_samples, diag.latched_presses);
+}
+
+static void check_filter()
+{
+    slider_filter_report_t filter = {SLIDER_FILTER_MAJORITY, 2, 3};
+    CHECK(control(0x21, HID_REQ_CONTROL_SET_REPORT, (HID_REPORT_TYPE_FEATURE << 8) | 0, 0, sizeof(filter), &filter) == sizeof(filter), "SET_REPORT");
+    pump();
+    diag_report_t diag = get_diag();
+    CHECK(diag.filter.mode == SLIDER_FILTER_MAJORITY && diag.filter.n == 2 && diag.filter.m == 3,
+          "filter %u,%u,%u after SET_REPORT", diag.filter.mode, diag.filter.n, diag.filter.m);
+
+    slider_filter_report_t invalid = {SLIDER_FILTER_MAJORITY, 4, 3};
+    control(0x21, HID_REQ_CONTROL_SET_REPORT, (HID_REPORT_TYPE_FEATURE << 8) | 0, 0, sizeof(invalid), &invalid);
+    pump();
+    diag = get_diag();
+    CHECK(diag.filter.n == 2 && diag.filter.m == 3, "invalid filter accepted");
+}
+
+int main(int argc, char **argv)
+{
+    bool kb = argc > 1 && !strcmp(argv[1], "kb");
+    s_variant = INPUT_EVENT_REPORT ? (kb ? "events_kb" : "events_joy") : (kb ? "kb" : "joy");
+
+    sim_init(false);
+    sim_set_level(PIN_MODESWITCH, kb);
+
+    // same bring up as main(), both loops are stepped by pump()
+    set_sys_clock_khz(200000, true);
+    init_pins();
+    board_init();
+    g_kb_mode = gpio_get(PIN_MODESWITCH);
+    s_latch_lock = spin_lock_init(spin_lock_claim_unused(true));
+    sim_advance_us(1000);
+    tusb_init();
+    button_sampler_init();
+    sniffer_init();
+    s_next_scan_us = time_us_32();
+
+    enumerate();
+    // the tap falls between two sends in both runs and is latched
+    run_scenario(1000);
+    check_diag(1, 2 * 1000 + 1000);
+    run_scenario(125);
+    check_diag(2, 2 * 1000 + 1000);
+    check_filter();
+#if INPUT_EVENT_REPORT
+    run_burst();
+#endif
+    check_ring_overrun();
+
+    usb_mock_stats_t stats = usb_mock_stats();
+    CHECK(!stats.rearmed_busy, "%u endpoints re-armed while busy", stats.rearmed_busy);
+
+    printf("%s: %s\n", s_variant, s_failures ? "FAILED" : "passed");
+    return s_failures ? 1 : 0;
+}
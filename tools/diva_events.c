@@ -0,0 +1,99 @@
+/**
+ * Ipega Diva Plus input event consumer (C) CrazyRedMachine 2025
+ *
+ * build: gcc -O2 -Wall -c tools/diva_events.c
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "diva_events.h"
+#include "../diva_protocol.h"
+
+static const char *button_names[] = {"TRIANGLE", "SQUARE", "CROSS", "CIRCLE", "L1", "R1", "L2", "R2", "SHARE",
+                                     "OPTIONS", "HOME", "R3", "L3", "UP", "RIGHT", "DOWN", "LEFT"};
+
+int diva_events_open(diva_events_t *dev, const char *hidraw_path)
+{
+    memset(dev, 0, sizeof(diva_events_t));
+    dev->fd = open(hidraw_path, O_RDONLY);
+    return (dev->fd < 0) ? -1 : 0;
+}
+
+void diva_events_close(diva_events_t *dev)
+{
+    if (dev->fd >= 0)
+        close(dev->fd);
+    dev->fd = -1;
+}
+
+int diva_events_read(diva_events_t *dev, diva_event_t *events, int max, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = dev->fd, .events = POLLIN};
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret <= 0)
+        return ret;
+
+    event_report_t report;
+    ssize_t len = read(dev->fd, &report, sizeof(report));
+    if (len < 0)
+        return -1;
+    if (len != sizeof(report) || report.count > EVENT_REPORT_EVENTS)
+    {
+        errno = EPROTO;
+        return -1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t host_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+    if (dev->have_report)
+    {
+        dev->lost_reports += (uint8_t)(report.seq - dev->last_seq - 1);
+        dev->dropped_events += (uint16_t)(report.dropped - dev->last_dropped);
+        dev->device_us += (uint32_t)(report.base_us - dev->last_base_us);
+    }
+    dev->have_report = 1;
+    dev->last_seq = report.seq;
+    dev->last_dropped = report.dropped;
+    dev->last_base_us = report.base_us;
+
+    int count = (report.count < max) ? report.count : max;
+    for (int i = 0; i < count; i++)
+    {
+        events[i].device_us = dev->device_us + report.events[i].dt_us;
+        events[i].host_ns = host_ns;
+        events[i].id = report.events[i].id;
+        events[i].state = report.events[i].state;
+    }
+    return count;
+}
+
+const char *diva_event_name(uint8_t id)
+{
+    static char name[16];
+
+    if (INPUT_ID_IS_BUTTON(id) && id < sizeof(button_names) / sizeof(button_names[0]))
+        return button_names[id];
+
+    if (INPUT_ID_IS_SLIDER(id))
+    {
+        // arcade numbering, 1 is the leftmost cell
+        snprintf(name, sizeof(name), "SLIDER%d", 32 - (id - INPUT_ID_SLIDER(0)));
+        return name;
+    }
+
+    if (INPUT_ID_IS_SLIDE(id))
+    {
+        snprintf(name, sizeof(name), "SLIDE%d", id - INPUT_ID_SLIDE(0));
+        return name;
+    }
+
+    snprintf(name, sizeof(name), "INPUT%u", id);
+    return name;
+}
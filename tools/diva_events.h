@@ -0,0 +1,40 @@
+#ifndef DIVA_EVENTS_H_
+#define DIVA_EVENTS_H_
+
+/* Host side consumer of the Ipega Diva Plus input event report (INPUT_EVENT_REPORT firmware).
+ * Reads the event interface hidraw node and returns input changes in order with
+ * their device timestamp extended to 64 bits.
+ */
+
+#include <stdint.h>
+
+typedef struct diva_event_s {
+    uint64_t device_us; // device time of the event (us since the first report read)
+    uint64_t host_ns;   // CLOCK_MONOTONIC time the report carrying it was read
+    uint8_t  id;        // INPUT_ID_* (see diva_protocol.h)
+    uint8_t  state;     // 1 pressed/touched, 0 released
+} diva_event_t;
+
+typedef struct diva_events_s {
+    int      fd;
+    int      have_report;
+    uint8_t  last_seq;
+    uint32_t last_base_us;
+    uint64_t device_us;      // extended base_us of the last report
+    uint16_t last_dropped;
+    uint64_t lost_reports;   // reports skipped between two reads (sequence gaps)
+    uint64_t dropped_events; // events dropped on the device while this consumer was reading
+} diva_events_t;
+
+// returns 0 on success, -1 on error (errno set)
+int diva_events_open(diva_events_t *dev, const char *hidraw_path);
+void diva_events_close(diva_events_t *dev);
+
+// Waits up to timeout_ms (-1: forever) for one event report and stores up to max events.
+// Returns the number of events, 0 on timeout, -1 on error.
+int diva_events_read(diva_events_t *dev, diva_event_t *events, int max, int timeout_ms);
+
+// "CROSS", "SLIDER12", ...
+const char *diva_event_name(uint8_t id);
+
+#endif /* DIVA_EVENTS_H_ */
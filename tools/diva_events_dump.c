@@ -0,0 +1,66 @@
+/**
+ * Ipega Diva Plus input event dump (C) CrazyRedMachine 2025
+ *
+ * Prints every input change received on the event interface.
+ *
+ * build: gcc -O2 -Wall -o diva_events_dump tools/diva_events_dump.c tools/diva_events.c
+ * usage: diva_events_dump /dev/hidrawX (the "event" interface, second hidraw node of the device)
+ */
+#include <stdio.h>
+
+#include "diva_events.h"
+#include "../diva_protocol.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s /dev/hidrawX\n", argv[0]);
+        return 1;
+    }
+
+    diva_events_t dev;
+    if (diva_events_open(&dev, argv[1]))
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uint64_t last_lost = 0, last_dropped = 0;
+    while (1)
+    {
+        diva_event_t events[16];
+        int count = diva_events_read(&dev, events, 16, -1);
+        if (count < 0)
+        {
+            perror("read");
+            break;
+        }
+
+        if (dev.lost_reports != last_lost || dev.dropped_events != last_dropped)
+        {
+            printf("lost %llu reports, %llu events dropped on the device\n",
+                   (unsigned long long)dev.lost_reports, (unsigned long long)dev.dropped_events);
+            last_lost = dev.lost_reports;
+            last_dropped = dev.dropped_events;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (INPUT_ID_IS_SLIDE(events[i].id))
+            {
+                static const char *types[] = {"?", "started", "continued", "ended"};
+                printf("%10llu us  %-9s %s cell %u %s\n", (unsigned long long)events[i].device_us,
+                       diva_event_name(events[i].id), types[SLIDE_STATE_TYPE(events[i].state)],
+                       SLIDE_STATE_CELL(events[i].state) + 1, SLIDE_STATE_LEFT(events[i].state) ? "left" : "right");
+                continue;
+            }
+            printf("%10llu us  %-9s %s\n", (unsigned long long)events[i].device_us,
+                   diva_event_name(events[i].id), events[i].state ? "on" : "off");
+        }
+        fflush(stdout);
+    }
+
+    diva_events_close(&dev);
+    return 0;
+}
@@ -0,0 +1,423 @@
+/**
+ * Ipega Diva Plus latency analyser (C) CrazyRedMachine 2025
+ *
+ * Reads gamepad reports from a Linux hidraw node (firmware built with REPORT_INPUT_AGE)
+ * and computes per-report input age, inter-report interval and dropped report statistics.
+ * Captures can be saved and replayed later to compare runs between host machines.
+ *
+ * build: gcc -O2 -Wall -o hid_latency tools/hid_latency.c
+ * usage: hid_latency [-n count] [-w capture.txt] [-v] /dev/hidrawX
+ *        hid_latency -r capture.txt [-e expected.txt] [-v] (exit status 2 when the statistics differ from expected.txt)
+ *        hid_latency -d /dev/hidrawX (print the device diagnostics feature report)
+ *        hid_latency -f mode,n,m /dev/hidrawX (set the slider filter, see diva_protocol.h)
+ *
+ * capture format: one report per line, "<host monotonic ns> <report bytes in hex>"
+ * tools/captures/sample.txt is a reference capture, its statistics are in tools/captures/sample.expected
+ *
+ * dropped only counts reports lost between the kernel and this reader (hidraw buffer overrun):
+ * the sequence number is incremented once tinyusb accepted a report, and an accepted report is
+ * retried until the host acknowledges it, so reports are never lost on the bus.
+ * The 4 bit sequence number wraps every 16 reports, so the gap it shows is completed with the number
+ * of whole wraps the host inter-arrival time allows (the firmware sends a report at every poll,
+ * the median interval is taken as the poll period).
+ *
+ * age is bucketed on the device: percentiles are bucket upper bounds, the average uses the bucket
+ * midpoints, and saturated samples (older than the largest bucket) are only counted.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/hidraw.h>
+
+#include "../diva_protocol.h"
+
+#define MAX_SAMPLES 1000000
+
+typedef struct stats_s {
+    uint64_t reports;
+    uint64_t last_ns;
+    int      last_seq;
+    uint32_t *age;       // upper bound of each report's age bucket (us)
+    uint32_t *interval;  // host inter-arrival time (us)
+    uint8_t  *seq_gap;   // sequence number difference over each interval (mod INPUT_AGE_SEQ_MOD)
+    uint64_t age_count;
+    uint64_t interval_count;
+    uint64_t age_mid_sum; // bucket midpoints of the non saturated samples
+    uint64_t age_saturated;
+} stats_t;
+
+static int verbose = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void stats_add(stats_t *st, uint64_t ts_ns, const uint8_t *buf, int len)
+{
+    if (len < JOY_REPORT_SIZE)
+        return;
+
+    uint8_t vendor = buf[JOY_REPORT_VENDOR_IDX];
+    int seq = input_age_seq(vendor);
+    uint32_t age = input_age_max_us(vendor);
+    uint32_t interval = 0;
+
+    if (st->reports)
+    {
+        interval = (uint32_t)((ts_ns - st->last_ns) / 1000);
+        if (st->interval_count < MAX_SAMPLES)
+        {
+            st->seq_gap[st->interval_count] = (seq - st->last_seq + INPUT_AGE_SEQ_MOD) % INPUT_AGE_SEQ_MOD;
+            st->interval[st->interval_count++] = interval;
+        }
+    }
+    if (st->age_count < MAX_SAMPLES)
+    {
+        st->age[st->age_count++] = age;
+        if (age == UINT32_MAX)
+            st->age_saturated++;
+        else
+            st->age_mid_sum += (input_age_min_us(vendor) + age) / 2;
+    }
+
+    if (verbose)
+        printf("%llu seq=%2d age=%u..%u us interval=%u us\n", (unsigned long long)ts_ns, seq,
+               input_age_min_us(vendor), age, interval);
+
+    st->reports++;
+    st->last_seq = seq;
+    st->last_ns = ts_ns;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// "sat" for saturated age samples
+static const char *fmt_us(char *buf, uint32_t v)
+{
+    if (v == UINT32_MAX)
+        return "sat";
+    snprintf(buf, 16, "%u", v);
+    return buf;
+}
+
+// sorts v
+static void print_distribution(FILE *out, const char *name, uint32_t *v, uint64_t n, uint64_t avg)
+{
+    if (!n)
+    {
+        fprintf(out, "%-10s no samples\n", name);
+        return;
+    }
+
+    char b[4][16];
+    qsort(v, n, sizeof(uint32_t), cmp_u32);
+    fprintf(out, "%-10s min %s  avg %llu  p50 %s  p99 %s  max %s (us)\n", name, fmt_us(b[0], v[0]),
+           (unsigned long long)avg, fmt_us(b[1], v[n / 2]), fmt_us(b[2], v[(n * 99) / 100]), fmt_us(b[3], v[n - 1]));
+}
+
+// reports the reader missed, from the sequence gaps completed with the wraps the intervals leave room for
+static uint64_t stats_dropped(const stats_t *st)
+{
+    if (!st->interval_count)
+        return 0;
+
+    uint32_t *sorted = malloc(st->interval_count * sizeof(uint32_t));
+    if (!sorted)
+        return 0;
+    memcpy(sorted, st->interval, st->interval_count * sizeof(uint32_t));
+    qsort(sorted, st->interval_count, sizeof(uint32_t), cmp_u32);
+    uint32_t period = sorted[st->interval_count / 2];
+    free(sorted);
+
+    uint64_t dropped = 0;
+    for (uint64_t i = 0; i < st->interval_count; i++)
+    {
+        int seq_missed = (st->seq_gap[i] + INPUT_AGE_SEQ_MOD - 1) % INPUT_AGE_SEQ_MOD;
+        int time_missed = period ? (int)((st->interval[i] + period / 2) / period) - 1 : 0;
+        int wraps = (time_missed > seq_missed) ? (time_missed - seq_missed + INPUT_AGE_SEQ_MOD / 2) / INPUT_AGE_SEQ_MOD : 0;
+        dropped += seq_missed + wraps * INPUT_AGE_SEQ_MOD;
+    }
+    return dropped;
+}
+
+static void stats_print(FILE *out, stats_t *st)
+{
+    uint64_t dropped = stats_dropped(st);
+    fprintf(out, "reports    %llu\n", (unsigned long long)st->reports);
+    fprintf(out, "dropped    %llu (%.3f%%)\n", (unsigned long long)dropped,
+            st->reports ? 100.0 * dropped / (st->reports + dropped) : 0.0);
+
+    uint64_t age_n = st->age_count - st->age_saturated;
+    print_distribution(out, "age", st->age, st->age_count, age_n ? st->age_mid_sum / age_n : 0);
+    if (st->age_saturated)
+        fprintf(out, "saturated  %llu (age above %u us)\n", (unsigned long long)st->age_saturated,
+                INPUT_AGE_UNIT_US << (INPUT_AGE_CODE_MAX - 1));
+
+    uint64_t interval_sum = 0;
+    for (uint64_t i = 0; i < st->interval_count; i++)
+        interval_sum += st->interval[i];
+    print_distribution(out, "interval", st->interval, st->interval_count,
+                       st->interval_count ? interval_sum / st->interval_count : 0);
+}
+
+// print the statistics and compare them with a previous run, returns 0 when identical, 2 when they differ
+static int stats_check(stats_t *st, const char *expected_path)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out)
+        return -1;
+    stats_print(out, st);
+    fclose(out);
+    fputs(text, stdout);
+
+    FILE *f = fopen(expected_path, "r");
+    if (!f)
+    {
+        perror(expected_path);
+        free(text);
+        return -1;
+    }
+    char *expected = calloc(1, size + 2);
+    size_t len = expected ? fread(expected, 1, size + 1, f) : 0;
+    fclose(f);
+
+    int ret = (expected && len == size && !memcmp(text, expected, size)) ? 0 : 2;
+    if (ret)
+        fprintf(stderr, "statistics differ from %s\n", expected_path);
+    free(expected);
+    free(text);
+    return ret;
+}
+
+static int replay(stats_t *st, const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), f))
+    {
+        unsigned long long ts;
+        char hex[200];
+        uint8_t buf[64];
+        int len = 0;
+
+        if (sscanf(line, "%llu %199s", &ts, hex) != 2)
+            continue;
+        for (char *p = hex; p[0] && p[1] && len < (int)sizeof(buf); p += 2)
+            sscanf(p, "%2hhx", &buf[len++]);
+        stats_add(st, ts, buf, len);
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static int capture(stats_t *st, const char *path, const char *out_path, uint64_t count)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    FILE *out = NULL;
+    if (out_path && !(out = fopen(out_path, "w")))
+    {
+        perror(out_path);
+        close(fd);
+        return -1;
+    }
+
+    while (!count || st->reports < count)
+    {
+        uint8_t buf[64];
+        int len = read(fd, buf, sizeof(buf));
+        uint64_t ts = now_ns();
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("read");
+            break;
+        }
+
+        if (out)
+        {
+            fprintf(out, "%llu ", (unsigned long long)ts);
+            for (int i = 0; i < len; i++)
+                fprintf(out, "%02x", buf[i]);
+            fputc('\n', out);
+        }
+        stats_add(st, ts, buf, len);
+    }
+
+    if (out)
+        fclose(out);
+    close(fd);
+    return 0;
+}
+
+static int print_diag(const char *path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    uint8_t buf[65] = {0}; // report id 0 followed by the report
+    int len = ioctl(fd, HIDIOCGFEATURE(sizeof(buf)), buf);
+    close(fd);
+    if (len < 0)
+    {
+        perror("HIDIOCGFEATURE");
+        return -1;
+    }
+
+    diag_report_t diag = {0};
+    memcpy(&diag, buf + 1, (len - 1 < (int)sizeof(diag)) ? len - 1 : (int)sizeof(diag));
+    if (diag.version == 0)
+    {
+        fprintf(stderr, "no diagnostics report\n");
+        return -1;
+    }
+
+    printf("diag version     %u (%u bytes)\n", diag.version, diag.size);
+    printf("latched presses  %u\n", diag.latched_presses);
+    printf("mount            %u us\n", diag.mount_us);
+    printf("first report     %u us\n", diag.first_report_us);
+    printf("sniffer restarts %u\n", diag.sniffer_restarts);
+    printf("watchdog reboot  %s\n", diag.watchdog_reboot ? "yes" : "no");
+    printf("slider filter    mode %u n %u m %u\n", diag.filter.mode, diag.filter.n, diag.filter.m);
+    printf("filter latency   +%u us press, +%u us release (scan period %u us)\n",
+           diag.filter_press_us, diag.filter_release_us, diag.scan_period_us);
+    printf("input to IN      min %u  avg %u  max %u us (%u changes)\n", diag.in_latency_min_us,
+           diag.in_latency_avg_us, diag.in_latency_max_us, diag.in_latency_samples);
+    printf("slide contacts   %u\n", diag.slide_contacts);
+    for (int i = 0; i < SLIDE_REPORT_CONTACTS && i < diag.slide_contacts; i++)
+        printf("  contact %d      cell %.2f, %d cells/s\n", i, diag.slide[i].position / 256.0, diag.slide[i].velocity);
+    return 0;
+}
+
+static int set_filter(const char *path, const char *arg)
+{
+    unsigned mode, n = 0, m = 0;
+    if (sscanf(arg, "%u,%u,%u", &mode, &n, &m) < 1)
+    {
+        fprintf(stderr, "invalid filter %s\n", arg);
+        return -1;
+    }
+
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    uint8_t buf[1 + sizeof(slider_filter_report_t)] = {0}; // report id 0 followed by the report
+    slider_filter_report_t filter = {mode, n, m};
+    memcpy(buf + 1, &filter, sizeof(filter));
+    int len = ioctl(fd, HIDIOCSFEATURE(sizeof(buf)), buf);
+    close(fd);
+    if (len < 0)
+    {
+        perror("HIDIOCSFEATURE");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *replay_path = NULL;
+    const char *expected_path = NULL;
+    const char *out_path = NULL;
+    const char *diag_path = NULL;
+    const char *filter_arg = NULL;
+    uint64_t count = 10000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:w:r:e:d:f:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 'w': out_path = optarg; break;
+            case 'r': replay_path = optarg; break;
+            case 'e': expected_path = optarg; break;
+            case 'd': diag_path = optarg; break;
+            case 'f': filter_arg = optarg; break;
+            case 'v': verbose = 1; break;
+            default:
+                fprintf(stderr, "usage: %s [-n count] [-w capture.txt] [-v] /dev/hidrawX\n"
+                                "       %s -r capture.txt [-e expected.txt] [-v]\n"
+                                "       %s -d /dev/hidrawX\n"
+                                "       %s -f mode,n,m /dev/hidrawX\n", argv[0], argv[0], argv[0], argv[0]);
+                return 1;
+        }
+    }
+
+    if (diag_path)
+        return print_diag(diag_path) ? 1 : 0;
+
+    if (filter_arg)
+    {
+        if (optind >= argc)
+        {
+            fprintf(stderr, "missing hidraw device\n");
+            return 1;
+        }
+        return set_filter(argv[optind], filter_arg) ? 1 : 0;
+    }
+
+    stats_t st = {0};
+    st.age = malloc(MAX_SAMPLES * sizeof(uint32_t));
+    st.interval = malloc(MAX_SAMPLES * sizeof(uint32_t));
+    st.seq_gap = malloc(MAX_SAMPLES);
+    if (!st.age || !st.interval || !st.seq_gap)
+        return 1;
+
+    int ret;
+    if (replay_path)
+        ret = replay(&st, replay_path);
+    else if (optind < argc)
+        ret = capture(&st, argv[optind], out_path, count);
+    else
+    {
+        fprintf(stderr, "missing hidraw device\n");
+        return 1;
+    }
+
+    if (ret == 0 && expected_path)
+        ret = stats_check(&st, expected_path);
+    else if (ret == 0)
+        stats_print(stdout, &st);
+
+    free(st.age);
+    free(st.interval);
+    free(st.seq_gap);
+    return (ret < 0) ? 1 : ret;
+}
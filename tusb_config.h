@@ -96,7 +96,11 @@ extern "C" {
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID 1 // one HID interface (for gamepad or KB)
+#ifndef INPUT_EVENT_REPORT
+#define INPUT_EVENT_REPORT 0 // second HID interface streaming timestamped input events (see diva_protocol.h)
+#endif
+
+#define CFG_TUD_HID (1 + INPUT_EVENT_REPORT) // one HID interface (for gamepad or KB), plus the event stream
 #define CFG_TUD_CDC 0
 #define CFG_TUD_MSC 0
 #define CFG_TUD_MIDI 0
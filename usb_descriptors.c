@@ -26,6 +26,7 @@
 #include "usb_descriptors.h"
 
 #include "tusb.h"
+#include "diva_protocol.h"
 
 #define VID 0x0F0D
 #define PID 0x00FB // HORI DIVA
@@ -173,14 +174,34 @@ uint8_t const desc_hid_report_kb[] = {
   HID_COLLECTION_END,
 };
 
+#if INPUT_EVENT_REPORT
+uint8_t const desc_hid_report_events[] = {
+  HID_USAGE_PAGE_N(HID_USAGE_PAGE_VENDOR, 2),
+  HID_USAGE(0x01),
+  HID_COLLECTION(HID_COLLECTION_APPLICATION),
+    HID_USAGE(0x02),
+    HID_LOGICAL_MIN(0),
+    HID_LOGICAL_MAX_N(255, 2),
+    HID_REPORT_SIZE(8),
+    HID_REPORT_COUNT(EVENT_REPORT_SIZE),
+    HID_INPUT(HID_DATA | HID_VARIABLE | HID_ABSOLUTE),
+  HID_COLLECTION_END,
+};
+#endif
+
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
 #define EPNUM_HID 0x81
-enum { ITF_NUM_HID, ITF_NUM_TOTAL };
+#define EPNUM_HID_EVENTS 0x82
+enum { ITF_NUM_HID,
+#if INPUT_EVENT_REPORT
+       ITF_NUM_HID_EVENTS,
+#endif
+       ITF_NUM_TOTAL };
 
-#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define CONFIG_TOTAL_LEN (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN * CFG_TUD_HID)
 
 uint8_t desc_configuration[] = {
     // Config number, interface count, string index, total length, attribute,
@@ -193,6 +214,11 @@ uint8_t desc_configuration[] = {
     TUD_HID_DESCRIPTOR(ITF_NUM_HID, 2, HID_ITF_PROTOCOL_NONE,
                        sizeof(desc_hid_report_joy), EPNUM_HID, // tud_descriptor_device_cb will update the placeholder value
                        CFG_TUD_HID_EP_BUFSIZE, 1),
+#if INPUT_EVENT_REPORT
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID_EVENTS, 0, HID_ITF_PROTOCOL_NONE,
+                       sizeof(desc_hid_report_events), EPNUM_HID_EVENTS,
+                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#endif
 };
 
 uint8_t const desc_configuration_kb[] = {
@@ -205,7 +231,13 @@ uint8_t const desc_configuration_kb[] = {
     // address, size & polling interval
     TUD_HID_DESCRIPTOR(ITF_NUM_HID, 4, HID_ITF_PROTOCOL_NONE,
                        sizeof(desc_hid_report_kb), EPNUM_HID,
-                       CFG_TUD_HID_EP_BUFSIZE, 1)};
+                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#if INPUT_EVENT_REPORT
+    TUD_HID_DESCRIPTOR(ITF_NUM_HID_EVENTS, 0, HID_ITF_PROTOCOL_NONE,
+                       sizeof(desc_hid_report_events), EPNUM_HID_EVENTS,
+                       CFG_TUD_HID_EP_BUFSIZE, 1),
+#endif
+};
 
 //--------------------------------------------------------------------+
 // Device Descriptors
@@ -221,7 +253,7 @@ tusb_desc_device_t desc_device = {
 
     .idVendor = VID,
     .idProduct = PID,
-    .bcdDevice = 0x0100,
+    .bcdDevice = 0x0100 + INPUT_EVENT_REPORT, // different interface set, hosts must not reuse a cached driver
 
     .iManufacturer = 0x01,
     .iProduct = 0x02,
@@ -240,7 +272,7 @@ tusb_desc_device_t desc_device_kb = {
 
     .idVendor = 0xCAFE,
     .idProduct = PID,
-    .bcdDevice = 0x0100,
+    .bcdDevice = 0x0100 + INPUT_EVENT_REPORT, // different interface set, hosts must not reuse a cached driver
 
     .iManufacturer = 0x01,
     .iProduct = 0x04,
@@ -273,6 +305,10 @@ uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
 uint8_t const* tud_hid_descriptor_report_cb(uint8_t itf) {
     if (itf == ITF_NUM_HID) 
         return (g_kb_mode ? desc_hid_report_kb : desc_hid_report_joy);
+#if INPUT_EVENT_REPORT
+    if (itf == ITF_NUM_HID_EVENTS)
+        return desc_hid_report_events;
+#endif
 
     return NULL;
 }